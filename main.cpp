@@ -1,280 +1,6254 @@
-#include <SFML/Graphics.hpp>
-#include <iostream>
-#include <filesystem>
-#include <memory>
-#include <vector>
-#include <string>
-#include <algorithm>
-#include <functional>
-#include <limits>
-
-#define WINDOW_WIDTH 800
-#define WINDOW_HEIGHT 800
-#define HORIZONTAL_PADDING 10.f
-#define TEXT_SIZE 20
-
-namespace fs = std::filesystem;
-
-struct FileNode {
-    std::string name;
-    std::vector<std::shared_ptr<FileNode>> children;
-    float x, y;
-    int leafCount;
-};
-
-// Recursively build the file tree
-std::shared_ptr<FileNode> buildTree(const fs::path& path) {
-    auto node = std::make_shared<FileNode>();
-    node->name = path.filename().string();
-    if (fs::is_directory(path)) {
-        for (auto& entry : fs::directory_iterator(path)) {
-            try {
-                node->children.push_back(buildTree(entry.path()));
-            } catch (const fs::filesystem_error& e) {
-                std::cerr << "Error: " << e.what() << '\n';
-            }
-        }
-    }
-    return node;
-}
-
-int maxDepth = 0;
-// Compute leaf counts and depth
-int computeLeafs(const std::shared_ptr<FileNode>& node, int depth = 0) {
-    maxDepth = std::max(maxDepth, depth);
-    if (node->children.empty())
-        return node->leafCount = 1;
-    int sum = 0;
-    for (auto& c : node->children)
-        sum += computeLeafs(c, depth + 1);
-    return node->leafCount = sum;
-}
-
-// Assign positions with uniform slot width
-void assignPositions(const std::shared_ptr<FileNode>& node,
-                     int depth, int& leafIndex,
-                     float slotWidth, float ySpacing) {
-    node->y = depth * ySpacing;
-    if (node->children.empty()) {
-        node->x = (leafIndex + 0.5f) * slotWidth;
-        ++leafIndex;
-    } else {
-        for (auto& c : node->children)
-            assignPositions(c, depth + 1, leafIndex, slotWidth, ySpacing);
-        float firstX = node->children.front()->x;
-        float lastX  = node->children.back()->x;
-        node->x = (firstX + lastX) * 0.5f;
-    }
-}
-
-// Draw tree edges using worldView
-void drawEdges(sf::RenderWindow& window, 
-               const std::shared_ptr<FileNode>& node) {
-    for (auto& c : node->children) {
-        sf::VertexArray line(sf::Lines, 2);
-        line[0].position = { node->x, node->y };
-        line[1].position = { c->x,        c->y };
-        line[0].color = sf::Color(100, 100, 100, 100);
-        window.draw(line);
-        drawEdges(window, c);
-    }
-}
-
-// Draw labels at world positions but fixed pixel size
-void drawLabels(sf::RenderWindow& window,
-                const std::shared_ptr<FileNode>& node,
-                const sf::Font& font,
-                float invZoom) {
-    sf::Text text;
-    text.setFont(font);
-    text.setCharacterSize(TEXT_SIZE);
-    text.setString(node->name);
-    text.setOutlineThickness(-1);
-    text.setOutlineColor(sf::Color::Black);
-
-    auto bounds = text.getLocalBounds();
-    text.setOrigin(bounds.left + bounds.width  / 2.f,
-                   bounds.top  + bounds.height / 2.f);
-
-    text.setPosition(node->x, node->y);
-    text.setScale(invZoom, invZoom);
-    text.setFillColor(sf::Color::White);
-    window.draw(text);
-
-    for (auto& c : node->children)
-        drawLabels(window, c, font, invZoom);
-}
-
-int main(int argc, char* argv[])
-{
-    // Determine root folder path from drag-and-drop or prompt
-    fs::path rootPath;
-    if (argc > 1) {
-        rootPath = fs::absolute(argv[1]);
-        std::cout << "Opening (dropped) path: " << rootPath << std::endl;
-    } else {
-        std::cout << "Enter root folder path: ";
-        std::string input;
-        std::getline(std::cin, input);
-        rootPath = fs::absolute(input);
-    }
-
-    if (!fs::exists(rootPath) || !fs::is_directory(rootPath)) {
-        std::cerr << "Invalid path.\n";
-        return 1;
-    }
-
-    std::cout << "Building tree...";
-    auto root = buildTree(rootPath);
-    int totalLeaves = computeLeafs(root);
-    int totalLevels = maxDepth + 1;
-    std::cout << "Done!" << std::endl;
-
-    std::cout << "Draw labels? (1/0): ";
-    int isDrawLabels = 0;
-    std::cin >> isDrawLabels;
-    std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-
-    std::cout << "Y scale: ";
-    float yScale;
-    std::cin >> yScale;
-
-    // Load font (for both labels and right-click display)
-    sf::Font font;
-    if (!font.loadFromFile("C:/Windows/Fonts/Arial.ttf")) {
-        std::cerr << "Failed to load font.\n";
-        return 1;
-    }
-    font.setSmooth(true);
-
-    // Measure max text width if drawing labels
-    float maxTextW = 0.f;
-    if (isDrawLabels) {
-        std::function<void(const std::shared_ptr<FileNode>&)> measure;
-        measure = [&](auto node) {
-            sf::Text t(node->name, font, TEXT_SIZE);
-            maxTextW = std::max(maxTextW, t.getLocalBounds().width);
-            for (auto& c : node->children)
-                measure(c);
-        };
-        measure(root);
-    }
-
-    float slotWidth = maxTextW + HORIZONTAL_PADDING;
-    float ySpacing  = yScale * WINDOW_HEIGHT / float(totalLevels);
-    int leafIndex = 0;
-    assignPositions(root, 0, leafIndex, slotWidth, ySpacing);
-
-    // For storing the node selected by right-click
-    std::shared_ptr<FileNode> selectedNode = nullptr;
-
-    bool isFullscreen = false;
-    sf::VideoMode windowedMode(WINDOW_WIDTH, WINDOW_HEIGHT);
-    const char* windowTitle = "File Tree";
-
-    sf::RenderWindow window(windowedMode, windowTitle, sf::Style::Close);
-    window.setFramerateLimit(60);
-
-    sf::View worldView = window.getDefaultView();
-    float worldWidth = slotWidth * totalLeaves;
-    worldView.setCenter(worldWidth / 2.f, WINDOW_HEIGHT / 2.f);
-
-    float currentZoom = 1.f;
-    bool running = true, panning = false;
-    sf::Vector2i dragStart;
-    sf::Vector2f viewStart;
-
-    while (running) {
-        sf::Event event;
-        while (window.pollEvent(event)) {
-            if (event.type == sf::Event::Closed ||
-               (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::Escape)) {
-                running = false;
-            }
-            else if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::F11) {
-                isFullscreen = !isFullscreen;
-                if (isFullscreen) {
-                    window.create(sf::VideoMode::getDesktopMode(), windowTitle, sf::Style::Fullscreen);
-                } else {
-                    window.create(windowedMode, windowTitle, sf::Style::Default);
-                }
-                window.setFramerateLimit(60);
-                sf::Vector2f px = window.getDefaultView().getSize();
-                worldView.setSize(px.x * currentZoom, px.y * currentZoom);
-                window.setView(worldView);
-            }
-            else if (event.type == sf::Event::MouseWheelScrolled) {
-                float factor = (event.mouseWheelScroll.delta > 0) ? 0.8f : 1.25f;
-                worldView.zoom(factor);
-                currentZoom *= factor;
-                window.setView(worldView);
-            }
-            else if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Left) {
-                panning = true;
-                dragStart = sf::Mouse::getPosition(window);
-                viewStart = worldView.getCenter();
-            }
-            else if (event.type == sf::Event::MouseButtonReleased && event.mouseButton.button == sf::Mouse::Left) {
-                panning = false;
-            }
-            else if (event.type == sf::Event::MouseMoved && panning) {
-                sf::Vector2i now = sf::Mouse::getPosition(window);
-                sf::Vector2f delta(
-                  (dragStart.x - now.x) * worldView.getSize().x / window.getSize().x,
-                  (dragStart.y - now.y) * worldView.getSize().y / window.getSize().y
-                );
-                worldView.setCenter(viewStart + delta);
-                window.setView(worldView);
-            }
-            // Right-click: find nearest node
-            else if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Right) {
-                auto pixel = sf::Mouse::getPosition(window);
-                auto worldPos = window.mapPixelToCoords(pixel);
-                float minDist = std::numeric_limits<float>::max();
-                std::shared_ptr<FileNode> nearest = nullptr;
-                
-                std::function<void(const std::shared_ptr<FileNode>&)> findNearest;
-                findNearest = [&](const std::shared_ptr<FileNode>& node) {
-                    float dx = node->x - worldPos.x;
-                    float dy = node->y - worldPos.y;
-                    float dist = dx*dx + dy*dy;
-                    if (dist < minDist) {
-                        minDist = dist;
-                        nearest = node;
-                    }
-                    for (auto& c : node->children)
-                        findNearest(c);
-                };
-                findNearest(root);
-                selectedNode = nearest;
-            }
-        }
-
-        window.clear(sf::Color::Black);
-        window.setView(worldView);
-        drawEdges(window, root);
-
-        if (isDrawLabels) {
-            drawLabels(window, root, font, currentZoom == 0 ? 1.f : currentZoom);
-        } else if (selectedNode) {
-            sf::Text text;
-            text.setFont(font);
-            text.setCharacterSize(TEXT_SIZE);
-            text.setString(selectedNode->name);
-            text.setOutlineThickness(-1);
-            text.setOutlineColor(sf::Color::Black);
-
-            auto bounds = text.getLocalBounds();
-            text.setOrigin(bounds.left + bounds.width/2.f,
-                           bounds.top  + bounds.height/2.f);
-            text.setPosition(selectedNode->x, selectedNode->y);
-            text.setScale(currentZoom, currentZoom);
-            text.setFillColor(sf::Color::White);
-            window.draw(text);
-        }
-
-        window.display();
-    }
-
-    return 0;
-}
+#include <SFML/Graphics.hpp>
+#include <SFML/OpenGL.hpp>
+#include <iostream>
+#include <filesystem>
+#include <memory>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <limits>
+#include <set>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <atomic>
+#include <mutex>
+#include <array>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <cstdlib>
+#include <cmath>
+#include <tuple>
+#include <thread>
+#include <unordered_map>
+#include <string_view>
+#include <locale>
+#include <new>
+#include <condition_variable>
+#include <cstring>
+#include <ctime>
+#include <type_traits>
+#include <charconv>
+#include <bitset>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#include <malloc.h>
+#else
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pwd.h>
+#include <grp.h>
+#endif
+
+#define WINDOW_WIDTH 800
+#define WINDOW_HEIGHT 800
+#define HORIZONTAL_PADDING 10.f
+#define TEXT_SIZE 20
+#define FONT_PATH "C:/Windows/Fonts/Arial.ttf"
+#define LABEL_OUTLINE -1.f
+#define REBASE_DISTANCE 1e5
+#define SDF_SIZE 48
+#define SDF_SPREAD 6
+#define DUP_BLOCK 65536
+#define DUP_IO_LIMIT 4
+#define STORE_KEYFRAME 16
+#define STORE_BLOCK 4096
+#define TOP_COUNT 20
+#define TYPE_COLORS 12
+#define OWNER_TOP 4
+#define BENCH_CHAIN_DEPTH 100001
+
+namespace fs = std::filesystem;
+
+// World coordinates are doubles: on very wide trees a float can no longer
+// tell neighbouring leaves apart
+typedef sf::Vector2<double> WorldPos;
+
+// ---- Heap allocation counting ----
+// Every global new goes through here so the frame loop can prove it stays
+// off the heap once the scene is built. Counted per thread, so the render
+// thread's count is not disturbed by work on other threads.
+
+thread_local std::uint64_t threadHeapAllocations = 0;
+
+// Every replaceable form is defined, so whichever new the compiler picks
+// is paired with a matching delete from this set
+void* heapAllocate(std::size_t size, std::size_t alignment) noexcept {
+    ++threadHeapAllocations;
+    if (size == 0)
+        size = 1;
+    if (alignment <= alignof(std::max_align_t))
+        return std::malloc(size);
+#ifdef _WIN32
+    return _aligned_malloc(size, alignment);
+#else
+    void* p = nullptr;
+    return posix_memalign(&p, alignment, size) == 0 ? p : nullptr;
+#endif
+}
+
+void heapRelease(void* p, std::size_t alignment) noexcept {
+#ifdef _WIN32
+    if (alignment > alignof(std::max_align_t)) {
+        _aligned_free(p);
+        return;
+    }
+#else
+    (void)alignment;
+#endif
+    std::free(p);
+}
+
+void* heapAllocateOrThrow(std::size_t size, std::size_t alignment) {
+    if (void* p = heapAllocate(size, alignment))
+        return p;
+    throw std::bad_alloc();
+}
+
+const std::size_t plainAlignment = alignof(std::max_align_t);
+
+void* operator new(std::size_t size) { return heapAllocateOrThrow(size, plainAlignment); }
+void* operator new[](std::size_t size) { return heapAllocateOrThrow(size, plainAlignment); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return heapAllocate(size, plainAlignment); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return heapAllocate(size, plainAlignment); }
+void* operator new(std::size_t size, std::align_val_t a) { return heapAllocateOrThrow(size, std::size_t(a)); }
+void* operator new[](std::size_t size, std::align_val_t a) { return heapAllocateOrThrow(size, std::size_t(a)); }
+void* operator new(std::size_t size, std::align_val_t a, const std::nothrow_t&) noexcept { return heapAllocate(size, std::size_t(a)); }
+void* operator new[](std::size_t size, std::align_val_t a, const std::nothrow_t&) noexcept { return heapAllocate(size, std::size_t(a)); }
+
+void operator delete(void* p) noexcept { heapRelease(p, plainAlignment); }
+void operator delete[](void* p) noexcept { heapRelease(p, plainAlignment); }
+void operator delete(void* p, std::size_t) noexcept { heapRelease(p, plainAlignment); }
+void operator delete[](void* p, std::size_t) noexcept { heapRelease(p, plainAlignment); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { heapRelease(p, plainAlignment); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { heapRelease(p, plainAlignment); }
+void operator delete(void* p, std::align_val_t a) noexcept { heapRelease(p, std::size_t(a)); }
+void operator delete[](void* p, std::align_val_t a) noexcept { heapRelease(p, std::size_t(a)); }
+void operator delete(void* p, std::size_t, std::align_val_t a) noexcept { heapRelease(p, std::size_t(a)); }
+void operator delete[](void* p, std::size_t, std::align_val_t a) noexcept { heapRelease(p, std::size_t(a)); }
+void operator delete(void* p, std::align_val_t a, const std::nothrow_t&) noexcept { heapRelease(p, std::size_t(a)); }
+void operator delete[](void* p, std::align_val_t a, const std::nothrow_t&) noexcept { heapRelease(p, std::size_t(a)); }
+
+// ---- Memory accounting ----
+// Long-lived containers allocate through TaggedAllocator, which keeps live,
+// peak and total bytes per subsystem so --mem-report can show what a tree
+// really costs.
+
+enum MemTag { MemNodes, MemNames, MemChildren, MemVertices, MemText, MemIndices, MemColumns, MemOwners, MemTagCount };
+const char* memTagNames[MemTagCount] = {
+    "tree nodes", "names", "children arrays", "vertex buffers", "text", "indices", "query columns", "owner summaries"
+};
+
+struct MemStats {
+    std::atomic<std::int64_t> live{ 0 };
+    std::atomic<std::int64_t> peak{ 0 };
+    std::atomic<std::uint64_t> allocations{ 0 };
+};
+MemStats memStats[MemTagCount];
+
+template <typename T, MemTag Tag>
+struct TaggedAllocator {
+    typedef T value_type;
+    template <typename U> struct rebind { typedef TaggedAllocator<U, Tag> other; };
+
+    TaggedAllocator() noexcept = default;
+    template <typename U>
+    TaggedAllocator(const TaggedAllocator<U, Tag>&) noexcept {}
+
+    T* allocate(std::size_t n) {
+        T* p = static_cast<T*>(::operator new(n * sizeof(T)));
+        MemStats& stats = memStats[Tag];
+        std::int64_t live = stats.live.fetch_add(std::int64_t(n * sizeof(T)),
+                                                 std::memory_order_relaxed) + std::int64_t(n * sizeof(T));
+        std::int64_t peak = stats.peak.load(std::memory_order_relaxed);
+        while (live > peak && !stats.peak.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {}
+        stats.allocations.fetch_add(1, std::memory_order_relaxed);
+        return p;
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept {
+        memStats[Tag].live.fetch_sub(std::int64_t(n * sizeof(T)), std::memory_order_relaxed);
+        ::operator delete(p);
+    }
+
+    template <typename U>
+    bool operator==(const TaggedAllocator<U, Tag>&) const noexcept { return true; }
+    template <typename U>
+    bool operator!=(const TaggedAllocator<U, Tag>&) const noexcept { return false; }
+};
+
+typedef std::basic_string<char, std::char_traits<char>, TaggedAllocator<char, MemNames>> NameString;
+typedef std::vector<sf::Vertex, TaggedAllocator<sf::Vertex, MemVertices>> VertexBuffer;
+
+// Live bytes for a tag
+std::int64_t memLive(MemTag tag) {
+    return memStats[tag].live.load(std::memory_order_relaxed);
+}
+
+enum class NodeType : std::uint8_t { File, Directory, Symlink, Other };
+
+// How an entry differs from an older snapshot, in diff mode
+enum class ChangeKind : std::uint8_t { Same, Added, Removed, Grown, Shrunk, Modified };
+
+struct FileNode;
+typedef std::vector<std::shared_ptr<FileNode>,
+                    TaggedAllocator<std::shared_ptr<FileNode>, MemChildren>> ChildList;
+
+// Bytes and files of one owner (a user or a group, as an OwnerTable index)
+struct OwnerUsage {
+    std::uint32_t owner;
+    std::uint64_t bytes = 0, files = 0;
+};
+typedef std::vector<OwnerUsage, TaggedAllocator<OwnerUsage, MemOwners>> OwnerList;
+
+// Who a directory's subtree belongs to: the OWNER_TOP users and groups
+// holding the most bytes, largest first, then one entry for all the others
+// if there are any. Lists are merged up the tree, so an owner that is
+// among the others in one subtree stays there in every directory above it.
+struct OwnerSummary {
+    OwnerList users, groups;
+};
+
+struct FileNode {
+    NameString name;
+    ChildList children;
+    FileNode* parent = nullptr;
+    double x, y;
+    int leafCount;                  // visible leaves; a collapsed subtree counts as one
+
+    // Layout cached relative to the subtree's own left edge, in slot units,
+    // so a subtree can be moved by shifting its origin
+    double relX = 0.5;
+    bool collapsed = false;
+    std::uint64_t descendants = 0;
+    int height = 0;                 // levels below this node
+
+    // Metadata read from the OS during the scan
+    NodeType type = NodeType::Other;
+    bool hardLinkSeen = false;      // another link to this inode was counted already
+    std::uint32_t duplicateSet = 0; // 1-based index of the file's duplicate set, 0 if none
+    std::uint32_t ext = 0;          // interned extension (see ExtensionTable); 0 for none
+    std::uint32_t user = 0, group = 0;  // interned owner ids (see OwnerTable); 0 if unknown
+    ChangeKind change = ChangeKind::Same;
+    std::int64_t sizeDelta = 0;     // change in totalSize since the older snapshot
+    std::uintmax_t size = 0;        // apparent size in bytes
+    std::uintmax_t allocated = 0;   // bytes allocated on disk
+    std::int64_t mtime = 0;         // seconds since the Unix epoch
+
+    // Subtree totals (including the node itself), filled in by computeLeafs
+    std::uintmax_t totalSize = 0;
+    std::uintmax_t totalAllocated = 0;
+    std::uint64_t fileCount = 0;
+    std::uint64_t hash = 0;         // Merkle hash of the node's metadata and whole subtree
+    std::uint32_t column = 0;       // index in the query columns (see buildColumns)
+    std::unique_ptr<OwnerSummary> owners;   // directories only, when computeLeafs is asked for owners
+
+    FileNode() = default;
+    FileNode(const FileNode&) = delete;
+    FileNode& operator=(const FileNode&) = delete;
+
+    // Tear the subtree down iteratively; letting every child's destructor
+    // release its own children would recurse once per directory level
+    ~FileNode() {
+        std::vector<std::shared_ptr<FileNode>,
+                    TaggedAllocator<std::shared_ptr<FileNode>, MemIndices>> pending(
+            std::make_move_iterator(children.begin()), std::make_move_iterator(children.end()));
+        children.clear();
+        while (!pending.empty()) {
+            std::shared_ptr<FileNode> node = std::move(pending.back());
+            pending.pop_back();
+            if (node.use_count() == 1)
+                for (auto& c : node->children)
+                    pending.push_back(std::move(c));
+        }
+    }
+};
+
+// Nodes and their shared_ptr control blocks come from one tagged allocation
+std::shared_ptr<FileNode> makeNode() {
+    return std::allocate_shared<FileNode>(TaggedAllocator<FileNode, MemNodes>());
+}
+
+// Tree walks use an explicit stack rather than recursion, so directory depth
+// is bounded by memory instead of the call stack, and take the visitor as a
+// template parameter so it is called directly rather than through std::function.
+
+// Pre-order walk. visit(node, depth) returns false to skip the node's children.
+template <typename Node, typename Visit>
+void walkPreorder(Node& root, Visit&& visit) {
+    std::vector<std::pair<Node*, int>, TaggedAllocator<std::pair<Node*, int>, MemIndices>> stack;
+    stack.push_back({ &root, 0 });
+    while (!stack.empty()) {
+        auto [node, depth] = stack.back();
+        stack.pop_back();
+        if (!visit(*node, depth))
+            continue;
+        for (auto it = node->children.rbegin(); it != node->children.rend(); ++it)
+            stack.push_back({ it->get(), depth + 1 });
+    }
+}
+
+// Post-order walk: visit(node) runs after all of the node's children.
+template <typename Node, typename Visit>
+void walkPostorder(Node& root, Visit&& visit) {
+    // Each entry holds the index of the next child to descend into
+    std::vector<std::pair<Node*, std::size_t>,
+                TaggedAllocator<std::pair<Node*, std::size_t>, MemIndices>> stack;
+    stack.push_back({ &root, 0 });
+    while (!stack.empty()) {
+        Node* node = stack.back().first;
+        std::size_t next = stack.back().second++;
+        if (next < node->children.size()) {
+            stack.push_back({ node->children[next].get(), 0 });
+        } else {
+            visit(*node);
+            stack.pop_back();
+        }
+    }
+}
+
+// (dev, inode) pairs of multiply-linked files already counted
+std::set<std::pair<std::uint64_t, std::uint64_t>> seenInodes;
+
+// Set while viewing the combined tree of two snapshots
+bool diffMode = false;
+
+// Lowercase extension of a name, without the dot; empty for none and for
+// dot files
+std::string_view extensionOf(std::string_view name, std::string& lower) {
+    std::size_t dot = name.rfind('.');
+    if (dot == std::string_view::npos || dot == 0 || dot + 1 == name.size())
+        return {};
+    lower.assign(name.substr(dot + 1));
+    for (char& ch : lower)
+        if (ch >= 'A' && ch <= 'Z')
+            ch = char(ch - 'A' + 'a');
+    return lower;
+}
+
+// File extensions interned to small ids as entries are created, so the
+// histogram, the palettes and queries index arrays instead of comparing
+// strings. Id 0 is no extension.
+struct ExtensionTable {
+    std::vector<std::string> names = std::vector<std::string>(1);
+    std::unordered_map<std::string, std::uint32_t> ids;
+    std::string scratch;
+
+    std::uint32_t intern(std::string_view name) {
+        if (extensionOf(name, scratch).empty())
+            return 0;
+        auto found = ids.find(scratch);
+        if (found != ids.end())
+            return found->second;
+        names.push_back(scratch);
+        return ids[scratch] = std::uint32_t(names.size() - 1);
+    }
+
+    // Id of a lowercase extension, or none of them if it was never seen
+    std::uint32_t find(const std::string& ext) const {
+        auto found = ids.find(ext);
+        return found == ids.end() ? std::numeric_limits<std::uint32_t>::max() : found->second;
+    }
+
+    std::size_t size() const { return names.size(); }
+};
+ExtensionTable extensions;
+
+// Numeric user or group ids interned to small indices as entries are
+// created, so per-owner sums index arrays. Index 0 is unknown: snapshots
+// and stores do not record owners.
+struct OwnerTable {
+    std::vector<std::uint32_t> ids = std::vector<std::uint32_t>(1);
+    std::unordered_map<std::uint32_t, std::uint32_t> index;
+
+    std::uint32_t intern(std::uint32_t id) {
+        auto [it, added] = index.emplace(id, std::uint32_t(ids.size()));
+        if (added)
+            ids.push_back(id);
+        return it->second;
+    }
+
+    std::size_t size() const { return ids.size(); }
+};
+OwnerTable users, groups;
+
+// OwnerUsage::owner of the entry summing everyone past the top OWNER_TOP
+const std::uint32_t otherOwners = std::numeric_limits<std::uint32_t>::max();
+
+// Name of an interned user or group, or its number if it has none
+std::string ownerName(std::uint32_t owner, bool isGroup) {
+    if (owner == otherOwners)
+        return "others";
+    if (owner == 0)
+        return "unknown";
+    std::uint32_t id = (isGroup ? groups : users).ids[owner];
+#ifndef _WIN32
+    if (!isGroup) {
+        if (const passwd* pw = getpwuid(uid_t(id)))
+            return pw->pw_name;
+    } else if (const struct group* gr = getgrgid(gid_t(id))) {
+        return gr->gr_name;
+    }
+#endif
+    return std::to_string(id);
+}
+
+// Set a node's extension id from its name and type
+void setExtension(FileNode& node) {
+    node.ext = node.type == NodeType::Directory
+        ? 0 : extensions.intern(std::string_view(node.name.data(), node.name.size()));
+}
+
+// ---- Tracing ----
+// TRACE_ZONE("name") records how long its scope took as a Chrome trace
+// event. Each thread writes into its own ring buffer, so recording takes no
+// locks; --trace FILE turns recording on and writes the buffers out as
+// trace-event JSON at exit. While tracing is off a zone costs one relaxed
+// atomic load.
+
+std::atomic<bool> traceEnabled{ false };
+
+struct TraceEvent {
+    const char* name;
+    std::int64_t startUs;
+    std::int64_t durationUs;
+};
+
+struct TraceBuffer {
+    static const std::size_t capacity = 1 << 16;   // oldest events are overwritten
+    std::vector<TraceEvent> events = std::vector<TraceEvent>(capacity);
+    std::atomic<std::uint64_t> written{ 0 };
+    int threadId = 0;
+};
+
+// Every thread's buffer, registered once on the thread's first event.
+// A thread that exits hands its buffer on to the next new one, so pools of
+// short-lived workers reuse a few buffers instead of adding one per thread.
+std::mutex traceBuffersMutex;
+std::vector<std::unique_ptr<TraceBuffer>> traceBuffers;
+std::vector<TraceBuffer*> freeTraceBuffers;     // of threads that have exited
+
+std::int64_t traceNowUs() {
+    static const auto epoch = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - epoch).count();
+}
+
+TraceBuffer& threadTraceBuffer() {
+    // Returns the buffer to the free list when its thread exits
+    struct Owner {
+        TraceBuffer* buffer = nullptr;
+        ~Owner() {
+            if (!buffer)
+                return;
+            std::lock_guard<std::mutex> lock(traceBuffersMutex);
+            freeTraceBuffers.push_back(buffer);
+        }
+    };
+    thread_local Owner owner;
+    if (!owner.buffer) {
+        std::lock_guard<std::mutex> lock(traceBuffersMutex);
+        if (!freeTraceBuffers.empty()) {
+            owner.buffer = freeTraceBuffers.back();
+            freeTraceBuffers.pop_back();
+        } else {
+            traceBuffers.push_back(std::make_unique<TraceBuffer>());
+            owner.buffer = traceBuffers.back().get();
+            owner.buffer->threadId = int(traceBuffers.size());
+        }
+    }
+    return *owner.buffer;
+}
+
+class TraceZone {
+public:
+    explicit TraceZone(const char* name)
+        : name(name), start(traceEnabled.load(std::memory_order_relaxed) ? traceNowUs() : -1) {}
+
+    ~TraceZone() {
+        if (start < 0)
+            return;
+        TraceBuffer& buffer = threadTraceBuffer();
+        std::uint64_t index = buffer.written.load(std::memory_order_relaxed);
+        buffer.events[index % TraceBuffer::capacity] = { name, start, traceNowUs() - start };
+        buffer.written.store(index + 1, std::memory_order_release);
+    }
+
+private:
+    const char* name;
+    std::int64_t start;
+};
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name)
+
+// Write everything recorded so far as Chrome trace-event JSON
+bool writeTrace(const std::string& path) {
+    std::ofstream out(path);
+    if (!out)
+        return false;
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    std::lock_guard<std::mutex> lock(traceBuffersMutex);
+    for (auto& buffer : traceBuffers) {
+        out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+            << buffer->threadId << ",\"args\":{\"name\":\""
+            << (buffer->threadId == 1 ? "main" : "worker " + std::to_string(buffer->threadId)) << "\"}}";
+        first = false;
+        std::uint64_t written = buffer->written.load(std::memory_order_acquire);
+        std::uint64_t begin = written > TraceBuffer::capacity ? written - TraceBuffer::capacity : 0;
+        for (std::uint64_t i = begin; i < written; ++i) {
+            const TraceEvent& e = buffer->events[i % TraceBuffer::capacity];
+            out << ",\n{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+                << buffer->threadId << ",\"ts\":" << e.startUs << ",\"dur\":" << e.durationUs << "}";
+        }
+    }
+    out << "\n]}\n";
+    return bool(out);
+}
+
+// Turns tracing on for its lifetime and writes the trace when it ends
+class TraceSession {
+public:
+    explicit TraceSession(std::string path) : path(std::move(path)) {
+        if (!this->path.empty()) {
+            threadTraceBuffer();    // register the main thread first
+            traceEnabled.store(true);
+        }
+    }
+
+    ~TraceSession() {
+        if (path.empty())
+            return;
+        traceEnabled.store(false);
+        if (writeTrace(path))
+            std::cerr << "Trace written to " << path << '\n';
+        else
+            std::cerr << "Failed to write trace to " << path << '\n';
+    }
+
+private:
+    std::string path;
+};
+
+// ---- Performance counters ----
+// Subsystems report what they do through perfCount and PhaseTimer; the
+// headless runner and the HUD read the numbers back.
+
+enum Counter { DrawCalls, Vertices, VisibleNodes, Labels, Rebuilds, Allocations, CounterCount };
+const char* counterNames[CounterCount] = { "draw calls", "vertices", "visible nodes", "labels",
+                                          "rebuilds", "allocations" };
+
+// Counts for the current frame
+struct FrameStats {
+    std::uint64_t counts[CounterCount] = {};
+    std::uint64_t operator[](Counter counter) const { return counts[counter]; }
+};
+FrameStats frameStats;
+
+inline void perfCount(Counter counter, std::uint64_t n = 1) {
+    frameStats.counts[counter] += n;
+}
+
+// Last duration of each one-off phase (scan, layout, ...), in milliseconds.
+// Written by whichever thread ran the phase and read by the HUD on the
+// render thread, so both sides hold phaseMutex.
+std::vector<std::pair<const char*, double>> phaseTimes;
+std::mutex phaseMutex;
+
+// Records how long its scope took under a phase name
+class PhaseTimer {
+public:
+    explicit PhaseTimer(const char* name)
+        : name(name), start(std::chrono::steady_clock::now()), zone(name) {}
+
+    ~PhaseTimer() {
+        double ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - start).count();
+        std::lock_guard<std::mutex> lock(phaseMutex);
+        for (auto& phase : phaseTimes)
+            if (phase.first == name) {
+                phase.second = ms;
+                return;
+            }
+        phaseTimes.push_back({ name, ms });
+    }
+
+private:
+    const char* name;
+    std::chrono::steady_clock::time_point start;
+    TraceZone zone;
+};
+
+// Human readable byte count, e.g. "1.5 GiB"
+std::string formatBytes(std::uintmax_t bytes) {
+    const char* units[] = { "B", "KiB", "MiB", "GiB", "TiB", "PiB" };
+    double value = double(bytes);
+    int unit = 0;
+    while (value >= 1024.0 && unit < 5) {
+        value /= 1024.0;
+        ++unit;
+    }
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), unit ? "%.1f %s" : "%.0f %s", value, units[unit]);
+    return buf;
+}
+
+// ---- Filesystem sources ----
+// buildTree reads directories through an FsSource, so the same scan can run
+// against the disk, an in-memory tree or a generated one.
+
+// One directory entry as reported by a source
+struct SourceEntry {
+    std::string name;
+    NodeType type = NodeType::Other;
+    std::uintmax_t size = 0;
+    std::uintmax_t allocated = 0;
+    std::int64_t mtime = 0;
+    std::uint64_t dev = 0, ino = 0;
+    std::uint64_t links = 1;
+    std::uint32_t uid = 0, gid = 0;
+    bool haveOwner = false;
+    std::uint64_t ref = 0;          // source-specific handle used to list a directory
+};
+
+class FsSource {
+public:
+    virtual ~FsSource() = default;
+    // Describe the root of the tree
+    virtual bool root(SourceEntry& out) = 0;
+    // Append the entries of a directory; false if it could not be read
+    virtual bool list(const SourceEntry& dir, int depth, std::vector<SourceEntry>& out) = 0;
+};
+
+// The real filesystem, read with lstat so symlinks are never followed
+class DiskSource : public FsSource {
+public:
+    explicit DiskSource(fs::path rootPath) : rootPath(std::move(rootPath)) {}
+
+    bool root(SourceEntry& out) override {
+        out = SourceEntry();
+        out.name = rootPath.filename().string();
+        if (!readMetadata(rootPath, out))
+            return false;
+        out.ref = remember(rootPath);
+        return true;
+    }
+
+    bool list(const SourceEntry& dir, int, std::vector<SourceEntry>& out) override {
+        auto found = dirPaths.find(dir.ref);
+        if (found == dirPaths.end())
+            return false;
+        fs::path dirPath = std::move(found->second);
+        dirPaths.erase(found);
+
+        std::error_code ec;
+        fs::directory_iterator it(dirPath, ec), end;
+        if (ec) {
+            std::cerr << "Error: " << dirPath.string() << ": " << ec.message() << '\n';
+            return false;
+        }
+        for (; it != end; it.increment(ec)) {
+            SourceEntry entry;
+            entry.name = it->path().filename().string();
+            readMetadata(it->path(), entry);
+            if (entry.type == NodeType::Directory)
+                entry.ref = remember(it->path());
+            out.push_back(std::move(entry));
+        }
+        if (ec)
+            std::cerr << "Error: " << dirPath.string() << ": " << ec.message() << '\n';
+        return true;
+    }
+
+private:
+    fs::path rootPath;
+    // Paths of directories handed out but not listed yet
+    std::unordered_map<std::uint64_t, fs::path> dirPaths;
+    std::uint64_t nextRef = 0;
+
+    std::uint64_t remember(const fs::path& path) {
+        dirPaths.emplace(nextRef, path);
+        return nextRef++;
+    }
+
+    // Fill in type, sizes and mtime without following symlinks
+    static bool readMetadata(const fs::path& path, SourceEntry& entry) {
+#ifndef _WIN32
+        struct stat st;
+        if (lstat(path.c_str(), &st) != 0)
+            return false;
+        if (S_ISDIR(st.st_mode))       entry.type = NodeType::Directory;
+        else if (S_ISREG(st.st_mode))  entry.type = NodeType::File;
+        else if (S_ISLNK(st.st_mode))  entry.type = NodeType::Symlink;
+        else                           entry.type = NodeType::Other;
+        entry.size      = std::uintmax_t(st.st_size);
+        entry.allocated = std::uintmax_t(st.st_blocks) * 512;
+        entry.mtime     = std::int64_t(st.st_mtime);
+        entry.dev       = std::uint64_t(st.st_dev);
+        entry.ino       = std::uint64_t(st.st_ino);
+        entry.links     = std::uint64_t(st.st_nlink);
+        entry.uid       = std::uint32_t(st.st_uid);
+        entry.gid       = std::uint32_t(st.st_gid);
+        entry.haveOwner = true;
+#else
+        std::error_code ec;
+        auto status = fs::symlink_status(path, ec);
+        if (ec)
+            return false;
+        switch (status.type()) {
+            case fs::file_type::directory: entry.type = NodeType::Directory; break;
+            case fs::file_type::regular:   entry.type = NodeType::File;      break;
+            case fs::file_type::symlink:   entry.type = NodeType::Symlink;   break;
+            default:                       entry.type = NodeType::Other;     break;
+        }
+        if (entry.type == NodeType::File) {
+            entry.size = fs::file_size(path, ec);
+            if (ec) entry.size = 0;
+            entry.allocated = entry.size;
+        }
+        auto ftime = fs::last_write_time(path, ec);
+        if (!ec) {
+            auto sys = std::chrono::system_clock::now() +
+                       (ftime - fs::file_time_type::clock::now());
+            entry.mtime = std::chrono::duration_cast<std::chrono::seconds>(
+                              sys.time_since_epoch()).count();
+        }
+#endif
+        return true;
+    }
+};
+
+// A tree held entirely in memory; entry refs are indices into it
+class MemorySource : public FsSource {
+public:
+    MemorySource() {
+        SourceEntry rootEntry;
+        rootEntry.type = NodeType::Directory;
+        nodes.push_back({ rootEntry, {} });
+    }
+
+    // Add an entry under a directory and return its id (the root is 0)
+    std::uint64_t add(std::uint64_t parent, SourceEntry entry) {
+        entry.ref = nodes.size();
+        nodes[parent].children.push_back(std::uint32_t(entry.ref));
+        nodes.push_back({ std::move(entry), {} });
+        return nodes.back().entry.ref;
+    }
+
+    SourceEntry& entry(std::uint64_t id) { return nodes[id].entry; }
+    std::size_t size() const { return nodes.size(); }
+
+    // Copy everything another source reports, e.g. to pin a generated tree
+    // in memory so repeated scans don't pay for generating it
+    void copyFrom(FsSource& source) {
+        nodes.clear();
+        SourceEntry rootEntry;
+        if (!source.root(rootEntry))
+            return;
+        nodes.push_back({ rootEntry, {} });
+        nodes[0].entry.ref = 0;
+
+        // (entry as the other source knows it, our id, depth)
+        std::vector<std::tuple<SourceEntry, std::uint64_t, int>> pending;
+        pending.emplace_back(std::move(rootEntry), 0, 0);
+        std::vector<SourceEntry> listing;
+        while (!pending.empty()) {
+            auto [dir, id, depth] = std::move(pending.back());
+            pending.pop_back();
+            listing.clear();
+            source.list(dir, depth, listing);
+            for (auto& e : listing) {
+                std::uint64_t childId = add(id, e);
+                if (e.type == NodeType::Directory)
+                    pending.emplace_back(std::move(e), childId, depth + 1);
+            }
+        }
+    }
+
+    bool root(SourceEntry& out) override {
+        if (nodes.empty())
+            return false;
+        out = nodes[0].entry;
+        return true;
+    }
+
+    bool list(const SourceEntry& dir, int, std::vector<SourceEntry>& out) override {
+        if (dir.ref >= nodes.size())
+            return false;
+        for (std::uint32_t c : nodes[dir.ref].children)
+            out.push_back(nodes[c].entry);
+        return true;
+    }
+
+private:
+    struct MemNode {
+        SourceEntry entry;
+        std::vector<std::uint32_t> children;
+    };
+    std::vector<MemNode> nodes;
+};
+
+// Parameters for a generated tree. The same parameters and seed always
+// produce the same tree.
+struct SyntheticParams {
+    enum class Fanout { Fixed, Uniform, Geometric };
+
+    int depth = 6;                  // directory levels below the root
+    double fanout = 8.0;            // mean entries per directory
+    Fanout fanoutDist = Fanout::Uniform;
+    double dirRatio = 0.25;         // share of entries that are directories
+    int nameMin = 4, nameMax = 16;  // name length range, uniform
+    double sizeMedian = 16384.0;    // file sizes are log-normal around this
+    double sizeSigma = 2.0;
+    std::uint64_t seed = 1;
+    std::uint64_t maxNodes = 0;     // stop producing entries after this many (0 = no limit)
+    std::uint32_t owners = 12;      // distinct users; a quarter as many groups, plus one
+};
+
+// Parse "key=value,key=value" into SyntheticParams; false on unknown keys
+bool parseSyntheticParams(const std::string& spec, SyntheticParams& params) {
+    std::size_t pos = 0;
+    while (pos < spec.size()) {
+        std::size_t comma = spec.find(',', pos);
+        std::string item = spec.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+        pos = comma == std::string::npos ? spec.size() : comma + 1;
+        std::size_t eq = item.find('=');
+        if (eq == std::string::npos)
+            return false;
+        std::string key = item.substr(0, eq), value = item.substr(eq + 1);
+        try {
+            if (key == "depth")          params.depth = std::stoi(value);
+            else if (key == "fanout")    params.fanout = std::stod(value);
+            else if (key == "dist") {
+                if (value == "fixed")          params.fanoutDist = SyntheticParams::Fanout::Fixed;
+                else if (value == "uniform")   params.fanoutDist = SyntheticParams::Fanout::Uniform;
+                else if (value == "geometric") params.fanoutDist = SyntheticParams::Fanout::Geometric;
+                else return false;
+            }
+            else if (key == "dirs")      params.dirRatio = std::stod(value);
+            else if (key == "namemin")   params.nameMin = std::stoi(value);
+            else if (key == "namemax")   params.nameMax = std::stoi(value);
+            else if (key == "size")      params.sizeMedian = std::stod(value);
+            else if (key == "sigma")     params.sizeSigma = std::stod(value);
+            else if (key == "seed")      params.seed = std::stoull(value);
+            else if (key == "nodes")     params.maxNodes = std::stoull(value);
+            else if (key == "owners")    params.owners = std::uint32_t(std::max(1, std::stoi(value)));
+            else return false;
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+    return params.nameMin >= 1 && params.nameMax >= params.nameMin && params.depth >= 0;
+}
+
+// splitmix64: small, fast and identical on every platform, unlike the
+// standard library's distributions
+struct SplitMix {
+    std::uint64_t state;
+    explicit SplitMix(std::uint64_t seed) : state(seed) {}
+    std::uint64_t next() {
+        std::uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+    double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+    int range(int lo, int hi) { return lo + int(next() % std::uint64_t(hi - lo + 1)); }
+};
+
+// Generates directories on demand from their ref, so nothing but the
+// scanner's own tree is kept in memory and even 100M-node trees are cheap
+class SyntheticSource : public FsSource {
+public:
+    explicit SyntheticSource(SyntheticParams params) : params(params) {}
+
+    bool root(SourceEntry& out) override {
+        produced = 1;
+        out = SourceEntry();
+        out.name = "synthetic";
+        out.type = NodeType::Directory;
+        out.ref = params.seed;
+        out.ino = out.ref;
+        out.mtime = baseTime;
+        return true;
+    }
+
+    bool list(const SourceEntry& dir, int depth, std::vector<SourceEntry>& out) override {
+        SplitMix rng(dir.ref * 0x2545f4914f6cdd1dull + params.seed);
+        int count = 0;
+        switch (params.fanoutDist) {
+            case SyntheticParams::Fanout::Fixed:
+                count = int(params.fanout + 0.5);
+                break;
+            case SyntheticParams::Fanout::Uniform:
+                count = rng.range(0, std::max(0, int(2 * params.fanout + 0.5)));
+                break;
+            case SyntheticParams::Fanout::Geometric: {
+                double p = 1.0 / (1.0 + params.fanout);
+                count = int(std::log(1.0 - rng.uniform()) / std::log(1.0 - p));
+                break;
+            }
+        }
+        for (int i = 0; i < count; ++i) {
+            if (params.maxNodes && produced >= params.maxNodes)
+                break;
+            ++produced;
+            SourceEntry entry;
+            bool isDir = depth + 1 < params.depth && rng.uniform() < params.dirRatio;
+            entry.type = isDir ? NodeType::Directory : NodeType::File;
+            entry.name = randomName(rng, isDir);
+            if (!isDir) {
+                // Box-Muller for a log-normal size
+                double u1 = 1.0 - rng.uniform(), u2 = rng.uniform();
+                double gauss = std::sqrt(-2.0 * std::log(u1)) * std::cos(6.283185307179586 * u2);
+                entry.size = std::uintmax_t(params.sizeMedian * std::exp(params.sizeSigma * gauss));
+                entry.allocated = (entry.size + 4095) / 4096 * 4096;
+            } else {
+                entry.size = entry.allocated = 4096;
+            }
+            entry.mtime = baseTime - std::int64_t(rng.next() % (5 * 365 * 86400ull));
+            entry.ref = rng.next();
+            entry.ino = entry.ref;
+            // Owners come from bits of the ref, so the random stream, and
+            // with it the tree, stays the same as without them
+            entry.uid = 1000 + std::uint32_t((entry.ref >> 8) % params.owners);
+            entry.gid = 100 + std::uint32_t((entry.ref >> 32) % (params.owners / 4 + 1));
+            entry.haveOwner = true;
+            out.push_back(std::move(entry));
+        }
+        return true;
+    }
+
+private:
+    static constexpr std::int64_t baseTime = 1700000000;
+    SyntheticParams params;
+    std::uint64_t produced = 0;
+
+    std::string randomName(SplitMix& rng, bool isDir) {
+        static const char* extensions[] = { ".txt", ".log", ".cpp", ".h", ".o", ".jpg",
+                                            ".png", ".json", ".gz", ".mp4", ".py", "" };
+        int length = rng.range(params.nameMin, params.nameMax);
+        std::string name(std::size_t(length), 'a');
+        for (char& ch : name)
+            ch = char('a' + rng.next() % 26);
+        if (!isDir)
+            name += extensions[rng.next() % (sizeof(extensions) / sizeof(extensions[0]))];
+        return name;
+    }
+};
+
+// Wraps another source and delays every call, to mimic a network filesystem
+class SlowSource : public FsSource {
+public:
+    SlowSource(std::unique_ptr<FsSource> inner, std::chrono::microseconds latency)
+        : inner(std::move(inner)), latency(latency) {}
+
+    bool root(SourceEntry& out) override {
+        std::this_thread::sleep_for(latency);
+        return inner->root(out);
+    }
+
+    bool list(const SourceEntry& dir, int depth, std::vector<SourceEntry>& out) override {
+        std::this_thread::sleep_for(latency);
+        return inner->list(dir, depth, out);
+    }
+
+private:
+    std::unique_ptr<FsSource> inner;
+    std::chrono::microseconds latency;
+};
+
+// Copy an entry's metadata into a tree node
+void applyEntry(const SourceEntry& entry, FileNode& node) {
+    node.name.assign(entry.name.data(), entry.name.size());
+    node.type      = entry.type;
+    node.size      = entry.size;
+    node.allocated = entry.allocated;
+    node.mtime     = entry.mtime;
+    if (entry.links > 1 && entry.type != NodeType::Directory)
+        node.hardLinkSeen = !seenInodes.insert({ entry.dev, entry.ino }).second;
+    setExtension(node);
+    if (entry.haveOwner) {
+        node.user  = users.intern(entry.uid);
+        node.group = groups.intern(entry.gid);
+    }
+}
+
+// Build the file tree, one directory at a time from an explicit stack
+std::shared_ptr<FileNode> buildTree(FsSource& source) {
+    TRACE_ZONE("buildTree");
+    seenInodes.clear();
+    auto root = makeNode();
+    SourceEntry rootEntry;
+    if (!source.root(rootEntry))
+        return root;
+    applyEntry(rootEntry, *root);
+
+    std::vector<std::tuple<FileNode*, SourceEntry, int>> pending;
+    if (root->type == NodeType::Directory)
+        pending.emplace_back(root.get(), std::move(rootEntry), 0);
+    std::vector<SourceEntry> listing;
+    while (!pending.empty()) {
+        auto [node, dir, depth] = std::move(pending.back());
+        pending.pop_back();
+
+        listing.clear();
+        bool listed;
+        {
+            TRACE_ZONE("readdir");
+            listed = source.list(dir, depth, listing);
+        }
+        if (!listed) {
+            // Unreadable directories are left out of the tree
+            if (FileNode* parent = node->parent) {
+                auto& siblings = parent->children;
+                siblings.erase(std::find_if(siblings.begin(), siblings.end(),
+                                            [&](auto& c) { return c.get() == node; }));
+            }
+            continue;
+        }
+        node->children.reserve(listing.size());
+        for (auto& entry : listing) {
+            auto child = makeNode();
+            child->parent = node;
+            applyEntry(entry, *child);
+            if (child->type == NodeType::Directory)
+                pending.emplace_back(child.get(), std::move(entry), depth + 1);
+            node->children.push_back(std::move(child));
+        }
+    }
+    return root;
+}
+
+// Run fn(begin, end) over [0, count) split into one contiguous chunk per
+// hardware thread; small inputs stay on the calling thread. Each chunk is a
+// trace zone on the thread that ran it.
+template <typename Fn>
+void parallelChunks(std::size_t count, Fn&& fn, std::size_t minChunk = 4096) {
+    std::size_t workers = std::max(1u, std::thread::hardware_concurrency());
+    workers = std::min(workers, std::max<std::size_t>(1, count / minChunk));
+    if (workers == 1) {
+        fn(std::size_t(0), count);
+        return;
+    }
+    auto run = [&fn](std::size_t begin, std::size_t end) {
+        TRACE_ZONE("chunk");
+        fn(begin, end);
+    };
+    std::vector<std::thread> threads;
+    std::size_t chunk = (count + workers - 1) / workers;
+    for (std::size_t begin = chunk; begin < count; begin += chunk)
+        threads.emplace_back([&run, begin, end = std::min(count, begin + chunk)] { run(begin, end); });
+    run(std::size_t(0), std::min(count, chunk));
+    for (auto& t : threads)
+        t.join();
+}
+
+// Run fn(i) for every i in [0, count) on up to `workers` threads, handing
+// out indices one at a time; for tasks of very uneven cost. fn may also
+// take the index of the thread running it, below workers, as fn(i, worker).
+// Each worker's whole run is a trace zone, so idle tails show up as gaps.
+template <typename Fn>
+void parallelFor(std::size_t count, unsigned workers, Fn&& fn) {
+    std::atomic<std::size_t> next{ 0 };
+    auto work = [&](unsigned worker) {
+        TRACE_ZONE("worker");
+        for (std::size_t i; (i = next.fetch_add(1)) < count;) {
+            if constexpr (std::is_invocable_v<Fn&, std::size_t, unsigned>)
+                fn(i, worker);
+            else
+                fn(i);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned w = 1; w < workers && w < count; ++w)
+        threads.emplace_back(work, w);
+    work(0u);
+    for (auto& t : threads)
+        t.join();
+}
+
+// Post-order walk that runs on every hardware thread: the top levels are
+// split off until there are enough subtrees to go round, each subtree is
+// walked on its own thread, then the top levels are visited bottom-up.
+// visit(node) may only touch the node and its direct children. Like
+// parallelFor's, it may take the worker index as a second argument; the
+// top levels are visited by worker 0.
+template <typename Visit>
+void walkPostorderParallel(FileNode& root, Visit&& visit) {
+    const unsigned workers = std::max(1u, std::thread::hardware_concurrency());
+    auto call = [&visit](FileNode& node, unsigned worker) {
+        if constexpr (std::is_invocable_v<Visit&, FileNode&, unsigned>)
+            visit(node, worker);
+        else
+            visit(node);
+    };
+    std::vector<FileNode*> top, frontier(1, &root), next;
+    for (int level = 0; level < 16 && frontier.size() < workers * 8u; ++level) {
+        next.clear();
+        for (FileNode* node : frontier) {
+            top.push_back(node);
+            for (auto& c : node->children)
+                next.push_back(c.get());
+        }
+        frontier.swap(next);
+        if (frontier.empty())
+            break;
+    }
+    parallelFor(frontier.size(), workers, [&](std::size_t i, unsigned worker) {
+        TRACE_ZONE("subtree");
+        walkPostorder(*frontier[i], [&](FileNode& node) { call(node, worker); });
+    });
+    // Breadth-first order reversed puts every node after its children
+    TRACE_ZONE("top levels");
+    for (auto it = top.rbegin(); it != top.rend(); ++it)
+        call(**it, 0);
+}
+
+// 64-bit finaliser from MurmurHash3
+inline std::uint64_t mix64(std::uint64_t v) {
+    v ^= v >> 33; v *= 0xFF51AFD7ED558CCDull;
+    v ^= v >> 33; v *= 0xC4CEB9FE1A85EC53ull;
+    return v ^ (v >> 33);
+}
+
+// FNV-1a over a name
+std::uint64_t nameHash(std::string_view name) {
+    std::uint64_t h = 0xCBF29CE484222325ull;
+    for (char ch : name)
+        h = (h ^ (unsigned char)ch) * 0x100000001B3ull;
+    return h;
+}
+
+// Hash of what a scan records about one entry: name, type, whether it is
+// a hard link counted elsewhere, sizes and mtime
+std::uint64_t entryHash(const FileNode& node) {
+    std::uint64_t h = mix64(nameHash(std::string_view(node.name.data(), node.name.size())) ^
+                            std::uint64_t(node.type) ^ (std::uint64_t(node.hardLinkSeen) << 8));
+    h = mix64(h ^ std::uint64_t(node.size));
+    h = mix64(h ^ std::uint64_t(node.allocated));
+    return mix64(h ^ std::uint64_t(node.mtime));
+}
+
+// Recompute a node's visible leaf count and relative x from its children's
+// cached layout
+void updateLayout(FileNode& node) {
+    if (node.collapsed || node.children.empty()) {
+        node.leafCount = 1;
+        node.relX = 0.5;
+        return;
+    }
+    int sum = 0;
+    for (auto& c : node.children)
+        sum += c->leafCount;
+    const FileNode& last = *node.children.back();
+    node.leafCount = sum;
+    node.relX = (node.children.front()->relX + (sum - last.leafCount) + last.relX) * 0.5;
+}
+
+// What the top lists rank entries by
+enum TopKind { TopFiles, TopDirsBySize, TopDirsByEntries, TopKindCount };
+const char* topKindNames[TopKindCount] = {
+    "Largest files", "Largest directories", "Directories with most entries"
+};
+
+// The largest entries by one measure: a bounded min-heap while it is being
+// filled, so each offer costs O(log limit), then sorted largest first
+struct TopList {
+    typedef std::pair<std::uint64_t, FileNode*> Entry;
+    std::vector<Entry> entries;
+    std::size_t limit = 0;
+
+    static bool larger(const Entry& a, const Entry& b) { return a.first > b.first; }
+
+    void offer(std::uint64_t key, FileNode* node) {
+        if (entries.size() < limit) {
+            entries.emplace_back(key, node);
+            std::push_heap(entries.begin(), entries.end(), larger);
+        } else if (limit && key > entries.front().first) {
+            std::pop_heap(entries.begin(), entries.end(), larger);
+            entries.back() = Entry(key, node);
+            std::push_heap(entries.begin(), entries.end(), larger);
+        }
+    }
+};
+
+// Top lists of a tree, filled by computeLeafs
+struct TopReport {
+    TopList lists[TopKindCount];
+
+    explicit TopReport(std::size_t limit = 0) {
+        for (TopList& list : lists)
+            list.limit = limit;
+    }
+
+    void offer(FileNode& node) {
+        if (node.change == ChangeKind::Removed)
+            return;
+        if (node.type != NodeType::Directory) {
+            lists[TopFiles].offer(node.totalSize, &node);
+        } else {
+            lists[TopDirsBySize].offer(node.totalSize, &node);
+            lists[TopDirsByEntries].offer(node.descendants, &node);
+        }
+    }
+
+    void merge(const TopReport& other) {
+        for (int k = 0; k < TopKindCount; ++k)
+            for (const TopList::Entry& e : other.lists[k].entries)
+                lists[k].offer(e.first, e.second);
+    }
+
+    // Sort each list largest first, ties by name, once all offers are in
+    void finish() {
+        for (TopList& list : lists)
+            std::sort(list.entries.begin(), list.entries.end(), [](const auto& a, const auto& b) {
+                if (a.first != b.first)
+                    return a.first > b.first;
+                return std::strcmp(a.second->name.c_str(), b.second->name.c_str()) < 0;
+            });
+    }
+};
+
+// Sums usage by owner index in a dense array, remembering which owners it
+// has seen so collecting them costs no more than adding them did
+struct OwnerAccumulator {
+    std::vector<std::uint64_t> bytes, files;
+    std::vector<std::uint8_t> seen;
+    std::vector<std::uint32_t> touched;
+    OwnerUsage others{ otherOwners };
+    bool haveOthers = false;
+
+    explicit OwnerAccumulator(std::size_t owners = 0) : bytes(owners), files(owners), seen(owners) {}
+
+    void add(std::uint32_t owner, std::uint64_t b, std::uint64_t f) {
+        if (owner == otherOwners) {
+            others.bytes += b;
+            others.files += f;
+            haveOthers = true;
+            return;
+        }
+        if (!seen[owner]) {
+            seen[owner] = 1;
+            touched.push_back(owner);
+        }
+        bytes[owner] += b;
+        files[owner] += f;
+    }
+
+    // Move the sums into a summary list, spilling all but the top
+    // OWNER_TOP into the others, and start again
+    void take(OwnerList& out) {
+        out.clear();
+        for (std::uint32_t owner : touched) {
+            out.push_back({ owner, bytes[owner], files[owner] });
+            bytes[owner] = files[owner] = 0;
+            seen[owner] = 0;
+        }
+        touched.clear();
+        std::sort(out.begin(), out.end(), [](const OwnerUsage& a, const OwnerUsage& b) {
+            return a.bytes != b.bytes ? a.bytes > b.bytes : a.owner < b.owner;
+        });
+        for (std::size_t i = OWNER_TOP; i < out.size(); ++i) {
+            others.bytes += out[i].bytes;
+            others.files += out[i].files;
+            haveOthers = true;
+        }
+        if (out.size() > OWNER_TOP)
+            out.resize(OWNER_TOP);
+        if (haveOthers)
+            out.push_back(others);
+        others = OwnerUsage{ otherOwners };
+        haveOthers = false;
+    }
+};
+
+// Exact bytes and files per user and per group over a whole tree, indexed
+// by OwnerTable index; filled by computeLeafs
+struct OwnerReport {
+    OwnerList users, groups;
+};
+
+// Compute leaf counts, heights and subtree hashes, and aggregate subtree
+// sizes in the same pass. Children are combined by sum, so a directory's
+// hash does not depend on the order they were listed in. With a report,
+// the pass also ranks entries into per-worker top lists, merged at the end.
+// With an owner report it also sums usage per owner, exactly for the whole
+// tree and as an OwnerSummary for every directory.
+int computeLeafs(FileNode& root, TopReport* top = nullptr, OwnerReport* owners = nullptr) {
+    TRACE_ZONE("computeLeafs");
+    const unsigned workers = std::max(1u, std::thread::hardware_concurrency());
+    const std::size_t limit = top ? top->lists[0].limit : 0;
+    std::vector<TopReport> parts(top ? workers : 0, TopReport(limit));
+    // Per worker: the summary being built, then the whole tree's totals
+    struct OwnerPart {
+        OwnerAccumulator users, groups, userTotals, groupTotals;
+    };
+    std::vector<OwnerPart> ownerParts(owners ? workers : 0, OwnerPart{
+        OwnerAccumulator(users.size()), OwnerAccumulator(groups.size()),
+        OwnerAccumulator(users.size()), OwnerAccumulator(groups.size()) });
+    walkPostorderParallel(root, [&parts, &ownerParts, top, owners](FileNode& node, unsigned worker) {
+        bool counted = !node.hardLinkSeen && node.change != ChangeKind::Removed;
+        node.totalSize      = counted ? node.size : 0;
+        node.totalAllocated = counted ? node.allocated : 0;
+        node.fileCount      = (counted && node.type != NodeType::Directory) ? 1 : 0;
+        node.descendants    = 0;
+        node.height         = 0;
+        std::uint64_t childHashes = 0;
+        for (auto& c : node.children) {
+            node.height          = std::max(node.height, c->height + 1);
+            node.totalSize      += c->totalSize;
+            node.totalAllocated += c->totalAllocated;
+            node.fileCount      += c->fileCount;
+            node.descendants    += c->descendants + 1;
+            childHashes         += c->hash;
+        }
+        node.hash = mix64(entryHash(node) ^ mix64(childHashes + node.children.size()));
+        updateLayout(node);
+        if (top)
+            parts[worker].offer(node);
+        if (owners) {
+            OwnerPart& part = ownerParts[worker];
+            const std::uint64_t bytes = counted ? node.size : 0;
+            const std::uint64_t files = node.type != NodeType::Directory && counted ? 1 : 0;
+            part.userTotals.add(node.user, bytes, files);
+            part.groupTotals.add(node.group, bytes, files);
+            if (node.type != NodeType::Directory) {
+                node.owners.reset();
+                return;
+            }
+            part.users.add(node.user, bytes, 0);
+            part.groups.add(node.group, bytes, 0);
+            for (auto& c : node.children) {
+                if (c->owners) {
+                    for (const OwnerUsage& u : c->owners->users)
+                        part.users.add(u.owner, u.bytes, u.files);
+                    for (const OwnerUsage& g : c->owners->groups)
+                        part.groups.add(g.owner, g.bytes, g.files);
+                } else {
+                    part.users.add(c->user, c->totalSize, c->fileCount);
+                    part.groups.add(c->group, c->totalSize, c->fileCount);
+                }
+            }
+            if (!node.owners)
+                node.owners = std::make_unique<OwnerSummary>();
+            part.users.take(node.owners->users);
+            part.groups.take(node.owners->groups);
+        }
+    });
+    if (top) {
+        *top = TopReport(limit);
+        for (const TopReport& part : parts)
+            top->merge(part);
+        top->finish();
+    }
+    if (owners) {
+        // Totals stay indexed by owner: sum the workers' arrays directly
+        owners->users.assign(users.size(), OwnerUsage{ 0 });
+        owners->groups.assign(groups.size(), OwnerUsage{ 0 });
+        for (std::uint32_t i = 0; i < users.size(); ++i)
+            owners->users[i].owner = i;
+        for (std::uint32_t i = 0; i < groups.size(); ++i)
+            owners->groups[i].owner = i;
+        for (const OwnerPart& part : ownerParts) {
+            for (std::uint32_t i = 0; i < users.size(); ++i) {
+                owners->users[i].bytes += part.userTotals.bytes[i];
+                owners->users[i].files += part.userTotals.files[i];
+            }
+            for (std::uint32_t i = 0; i < groups.size(); ++i) {
+                owners->groups[i].bytes += part.groupTotals.bytes[i];
+                owners->groups[i].files += part.groupTotals.files[i];
+            }
+        }
+    }
+    return root.leafCount;
+}
+
+// Path of a node within its tree: the names from the root down, joined by '/'
+std::string treePath(const FileNode& node) {
+    std::vector<const FileNode*> chain;
+    for (const FileNode* n = &node; n; n = n->parent)
+        chain.push_back(n);
+    std::string path;
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+        if (!path.empty() && path.back() != '/')
+            path += '/';
+        path += (*it)->name.c_str();
+    }
+    return path;
+}
+
+// Owner totals of a report, largest first, leaving out owners with nothing
+std::vector<OwnerUsage> rankOwners(const OwnerList& totals) {
+    std::vector<OwnerUsage> ranked;
+    for (const OwnerUsage& u : totals)
+        if (u.bytes || u.files)
+            ranked.push_back(u);
+    std::sort(ranked.begin(), ranked.end(), [](const OwnerUsage& a, const OwnerUsage& b) {
+        return a.bytes != b.bytes ? a.bytes > b.bytes : a.owner < b.owner;
+    });
+    return ranked;
+}
+
+// Usage per user and per group, then who owns each of the largest
+// top-level directories
+void printOwnerReport(std::ostream& out, const OwnerReport& report, const FileNode& root,
+                      std::size_t count) {
+    char line[64];
+    for (int g = 0; g < 2; ++g) {
+        out << (g ? "Groups:\n" : "Users:\n");
+        std::vector<OwnerUsage> ranked = rankOwners(g ? report.groups : report.users);
+        for (std::size_t i = 0; i < std::min(count, ranked.size()); ++i) {
+            std::snprintf(line, sizeof(line), "%16s  %10llu files  ", formatBytes(ranked[i].bytes).c_str(),
+                          (unsigned long long)ranked[i].files);
+            out << line << ownerName(ranked[i].owner, g) << '\n';
+        }
+    }
+    std::vector<const FileNode*> dirs;
+    for (auto& c : root.children)
+        if (c->owners)
+            dirs.push_back(c.get());
+    std::sort(dirs.begin(), dirs.end(), [](const FileNode* a, const FileNode* b) {
+        return a->totalSize > b->totalSize;
+    });
+    out << "Owners by directory:\n";
+    for (std::size_t i = 0; i < std::min(count, dirs.size()); ++i) {
+        out << "  " << treePath(*dirs[i]) << ':';
+        const char* separator = " ";
+        for (const OwnerUsage& u : dirs[i]->owners->users) {
+            out << separator << ownerName(u.owner, false) << ' ' << formatBytes(u.bytes);
+            separator = ", ";
+        }
+        out << '\n';
+    }
+}
+
+// Top list entry's measure, as shown in reports
+std::string formatTopKey(int kind, std::uint64_t key) {
+    return kind == TopDirsByEntries ? std::to_string(key) + " entries" : formatBytes(key);
+}
+
+void printTopReport(std::ostream& out, const TopReport& report, std::size_t count) {
+    char line[32];
+    for (int k = 0; k < TopKindCount; ++k) {
+        out << topKindNames[k] << ":\n";
+        const auto& entries = report.lists[k].entries;
+        for (std::size_t i = 0; i < std::min(count, entries.size()); ++i) {
+            std::snprintf(line, sizeof(line), "%16s  ", formatTopKey(k, entries[i].first).c_str());
+            out << line << treePath(*entries[i].second) << '\n';
+        }
+    }
+}
+
+// Compare two scans of a tree, descending only where subtree hashes differ.
+// visit(before, after, depth) is called for every entry that changed, with
+// a null side for entries that were added or removed; children are matched
+// by name and visited only if visit returns true and both sides are
+// directories.
+template <typename Node, typename Visit>
+void walkChanges(Node& before, Node& after, Visit&& visit) {
+    if (before.hash == after.hash)
+        return;
+    typedef std::vector<Node*> Children;
+    auto sorted = [](Node& node) {
+        Children children;
+        children.reserve(node.children.size());
+        for (auto& c : node.children)
+            children.push_back(c.get());
+        std::sort(children.begin(), children.end(),
+                  [](Node* a, Node* b) { return a->name < b->name; });
+        return children;
+    };
+    std::vector<std::tuple<Node*, Node*, int>> stack;
+    stack.emplace_back(&before, &after, 0);
+    while (!stack.empty()) {
+        auto [a, b, depth] = stack.back();
+        stack.pop_back();
+        if (!visit(a, b, depth) || !a || !b ||
+            a->type != NodeType::Directory || b->type != NodeType::Directory)
+            continue;
+        Children as = sorted(*a), bs = sorted(*b);
+        std::size_t i = 0, j = 0;
+        while (i < as.size() || j < bs.size()) {
+            if (j == bs.size() || (i < as.size() && as[i]->name < bs[j]->name)) {
+                stack.emplace_back(as[i++], (Node*)nullptr, depth + 1);
+            } else if (i == as.size() || bs[j]->name < as[i]->name) {
+                stack.emplace_back((Node*)nullptr, bs[j++], depth + 1);
+            } else {
+                if (as[i]->hash != bs[j]->hash)
+                    stack.emplace_back(as[i], bs[j], depth + 1);
+                ++i;
+                ++j;
+            }
+        }
+    }
+}
+
+// Collapse or expand a subtree. Only the path to the root is relaid out;
+// the subtree keeps its cached layout for when it is expanded again.
+void toggleCollapse(FileNode& node) {
+    if (node.children.empty())
+        return;
+    node.collapsed = !node.collapsed;
+    for (FileNode* n = &node; n; n = n->parent)
+        updateLayout(*n);
+}
+
+// True if some ancestor of the node is collapsed
+bool isHidden(const FileNode& node) {
+    for (const FileNode* p = node.parent; p; p = p->parent)
+        if (p->collapsed)
+            return true;
+    return false;
+}
+
+// True if the node lies in the subtree rooted at ancestor
+bool isUnder(const FileNode& node, const FileNode& ancestor) {
+    for (const FileNode* p = &node; p; p = p->parent)
+        if (p == &ancestor)
+            return true;
+    return false;
+}
+
+// Bumped whenever node positions change, so cached geometry knows it is stale
+std::uint64_t layoutVersion = 1;
+
+// Turn the cached relative layout into world positions, starting at the
+// given slot offset. Only visible nodes are touched.
+void assignPositions(FileNode& root, int originSlot,
+                     double slotWidth, double ySpacing, int rootDepth = 0) {
+    TRACE_ZONE("assignPositions");
+    ++layoutVersion;
+    // In pre-order, a node's origin is wherever the previous sibling's
+    // subtree ended; its children then start at its own origin
+    std::vector<int> cursor(1, originSlot);
+    walkPreorder(root, [&](FileNode& node, int depth) {
+        if (int(cursor.size()) <= depth + 1)
+            cursor.resize(depth + 2);
+        int origin = cursor[depth];
+        cursor[depth] += node.leafCount;
+        cursor[depth + 1] = origin;
+        node.x = (origin + node.relX) * slotWidth;
+        node.y = (rootDepth + depth) * ySpacing;
+        return !node.collapsed;
+    });
+}
+
+// Collapse or expand a node under layoutRoot and move only what that
+// moves: the node's own subtree, its ancestors (whose relative x changes)
+// and the visible nodes after it in pre-order, which shift by the change
+// in its leaf count. Everything before it stays put, so the cost is that
+// of the subtree and the nodes to its right rather than the whole view.
+void toggleAndShift(FileNode& node, const FileNode& layoutRoot,
+                    double slotWidth, double ySpacing) {
+    TRACE_ZONE("toggleAndShift");
+    if (node.children.empty())
+        return;
+    auto originOf = [&](const FileNode& n) { return int(std::lround(n.x / slotWidth - n.relX)); };
+
+    // Origins of the node and its ancestors up to the layout root, which a
+    // change further right does not move
+    std::vector<std::pair<FileNode*, int>> path;
+    for (FileNode* n = &node;; n = n->parent) {
+        path.push_back({ n, originOf(*n) });
+        if (n == &layoutRoot)
+            break;
+    }
+    const int oldLeaves = node.leafCount;
+    toggleCollapse(node);
+    const int delta = node.leafCount - oldLeaves;
+
+    assignPositions(node, path.front().second, slotWidth, ySpacing, int(path.size()) - 1);
+    for (std::size_t i = 1; i < path.size(); ++i) {
+        auto [ancestor, origin] = path[i];
+        ancestor->x = (origin + ancestor->relX) * slotWidth;
+        if (!delta)
+            continue;
+        // Later siblings of the child on the path, and their subtrees
+        const FileNode* child = path[i - 1].first;
+        auto it = std::find_if(ancestor->children.begin(), ancestor->children.end(),
+                               [&](const std::shared_ptr<FileNode>& c) { return c.get() == child; });
+        for (++it; it != ancestor->children.end(); ++it)
+            walkPreorder(**it, [&](FileNode& n, int) {
+                n.x = (originOf(n) + delta + n.relX) * slotWidth;
+                return !n.collapsed;
+            });
+    }
+}
+
+// Byte to code point, the same conversion sf::String applies to a std::string
+const sf::Uint32* ansiCodepoints() {
+    struct Table {
+        sf::Uint32 codepoints[256];
+        Table() {
+            std::locale locale;
+            for (int i = 0; i < 256; ++i)
+                codepoints[i] = sf::Utf32::decodeAnsi(char(i), locale);
+        }
+    };
+    static const Table table;
+    return table.codepoints;
+}
+
+// Advances, horizontal glyph bounds and kerning of one font at TEXT_SIZE,
+// indexed by byte. Reads sf::Font only while being built, so widths can
+// then be computed from any thread.
+struct LabelMetrics {
+    float advance[256] = {};
+    float left[256] = {};
+    float right[256] = {};
+    float top[256] = {};
+    float bottom[256] = {};
+    std::vector<float> kerning;                 // [previous byte * 256 + byte]
+
+    // Only bytes marked in used get kerning pairs looked up
+    LabelMetrics(const sf::Font& font, const std::array<bool, 256>& used) : kerning(256 * 256, 0.f) {
+        const sf::Uint32* ansi = ansiCodepoints();
+        for (int c = 0; c < 256; ++c) {
+            const sf::Glyph& glyph = font.getGlyph(ansi[c], TEXT_SIZE, false);
+            advance[c] = glyph.advance;
+            left[c] = glyph.bounds.left;
+            right[c] = glyph.bounds.left + glyph.bounds.width;
+            top[c] = glyph.bounds.top;
+            bottom[c] = glyph.bounds.top + glyph.bounds.height;
+        }
+        for (int a = 1; a < 256; ++a) {
+            if (!used[a])
+                continue;
+            for (int b = 1; b < 256; ++b)
+                if (used[b])
+                    kerning[a * 256 + b] = font.getKerning(ansi[a], ansi[b], TEXT_SIZE);
+        }
+    }
+
+    // Width of sf::Text::getLocalBounds() for text at TEXT_SIZE
+    float width(std::string_view text) const {
+        if (text.empty())
+            return 0.f;
+        float x = 0.f, minX = float(TEXT_SIZE), maxX = 0.f;
+        unsigned char prev = 0;
+        for (char ch : text) {
+            unsigned char c = (unsigned char)ch;
+            if (c == '\r')
+                continue;
+            x += kerning[prev * 256 + c];
+            prev = c;
+            if (c == ' ' || c == '\t' || c == '\n') {
+                minX = std::min(minX, x);
+                x = c == '\n' ? 0.f : x + advance[' '] * (c == '\t' ? 4 : 1);
+                maxX = std::max(maxX, x);
+                continue;
+            }
+            minX = std::min(minX, x + left[c]);
+            maxX = std::max(maxX, x + right[c]);
+            x += advance[c];
+        }
+        return maxX - minX;
+    }
+};
+
+// Bytes that occur in any name of the tree
+std::array<bool, 256> usedNameBytes(const FileNode& root) {
+    std::array<bool, 256> used{};
+    walkPreorder(root, [&](const FileNode& node, int) {
+        for (char ch : node.name)
+            used[(unsigned char)ch] = true;
+        return true;
+    });
+    return used;
+}
+
+// Widest label in the tree, measured with the font used for drawing
+float measureLabels(const FileNode& root, const sf::Font& font) {
+    TRACE_ZONE("measureLabels");
+    std::vector<const FileNode*> nodes;
+    std::array<bool, 256> used{};
+    walkPreorder(root, [&](const FileNode& node, int) {
+        nodes.push_back(&node);
+        for (char ch : node.name)
+            used[(unsigned char)ch] = true;
+        return true;
+    });
+
+    LabelMetrics metrics(font, used);
+    std::mutex mutex;
+    float maxTextW = 0.f;
+    parallelChunks(nodes.size(), [&](std::size_t begin, std::size_t end) {
+        float widest = 0.f;
+        for (std::size_t i = begin; i < end; ++i)
+            widest = std::max(widest, metrics.width(nodes[i]->name));
+        std::lock_guard<std::mutex> lock(mutex);
+        maxTextW = std::max(maxTextW, widest);
+    });
+    return maxTextW;
+}
+
+// Find the visible node closest to a world position
+FileNode* pickNearest(FileNode& root, const WorldPos& worldPos) {
+    TRACE_ZONE("pickNearest");
+    double minDist = std::numeric_limits<double>::max();
+    FileNode* nearest = nullptr;
+    walkPreorder(root, [&](FileNode& node, int) {
+        double dx = node.x - worldPos.x;
+        double dy = node.y - worldPos.y;
+        double dist = dx*dx + dy*dy;
+        if (dist < minDist) {
+            minDist = dist;
+            nearest = &node;
+        }
+        return !node.collapsed;
+    });
+    return nearest;
+}
+
+// Geometry handed to SFML is relative to the camera, so the floats only
+// ever hold small on-screen offsets however far out the camera is
+sf::Vector2f toView(double x, double y, const WorldPos& camera) {
+    return sf::Vector2f(float(x - camera.x), float(y - camera.y));
+}
+
+void countDraw(std::size_t vertices) {
+    perfCount(DrawCalls);
+    perfCount(Vertices, vertices);
+}
+
+// ---- Queries ----
+// --filter EXPR marks the nodes matching an expression such as
+//   type = file and size > 1GiB and age > 180d and path ~ "*/logs/*"
+// Terms compare a field with a value: size (bytes, with an optional K, M,
+// G or T binary unit), age (s, m, h, d, w or y; days if no unit), mtime
+// (Unix seconds or YYYY-MM-DD), depth, type (file, dir, link, other) and
+// ext (the part after the last dot, lowercase); name and path match a glob
+// with ~ where * is any run of characters and ? any one. Terms combine
+// with and, or, not and parentheses.
+//
+// The expression is compiled into a postfix program and run over the
+// tree's columns, 64 nodes at a time: each comparison turns a run of 64
+// column values into one word of match bits, and the connectives are
+// single word operations. Words are split across threads.
+
+// The tree in pre-order, one array per field; a node's column index is
+// its position here
+struct NodeColumns {
+    template <typename T>
+    using Column = std::vector<T, TaggedAllocator<T, MemColumns>>;
+
+    Column<FileNode*> nodes;
+    Column<std::uint32_t> parents;  // column index of the parent; the root's is its own
+    Column<std::uint64_t> sizes;
+    Column<std::int64_t> mtimes;
+    Column<std::uint8_t> types;
+    Column<std::uint32_t> exts;     // extension ids; 0 for none
+    Column<std::uint16_t> depths;
+
+    std::size_t size() const { return nodes.size(); }
+};
+
+void buildColumns(NodeColumns& columns, FileNode& root) {
+    TRACE_ZONE("buildColumns");
+    const std::size_t count = std::size_t(root.descendants + 1);
+    columns = NodeColumns();
+    columns.nodes.reserve(count);
+    columns.parents.reserve(count);
+    columns.sizes.reserve(count);
+    columns.mtimes.reserve(count);
+    columns.types.reserve(count);
+    columns.exts.reserve(count);
+    columns.depths.reserve(count);
+    walkPreorder(root, [&](FileNode& node, int depth) {
+        node.column = std::uint32_t(columns.nodes.size());
+        columns.nodes.push_back(&node);
+        columns.parents.push_back(node.parent ? node.parent->column : node.column);
+        columns.sizes.push_back(node.size);
+        columns.mtimes.push_back(node.mtime);
+        columns.types.push_back(std::uint8_t(node.type));
+        columns.exts.push_back(node.ext);
+        columns.depths.push_back(std::uint16_t(std::min(depth, 0xFFFF)));
+        return true;
+    });
+}
+
+// A glob as a bit-parallel automaton: bit j of a state means the first j
+// pattern characters have been matched
+struct Glob {
+    std::uint64_t accepts[256] = {};    // positions whose character (or ?) matches a byte
+    std::uint64_t stars = 0;            // positions holding a *
+    std::uint64_t final = 0;
+    std::uint64_t start = 0;
+
+    bool compile(const std::string& pattern) {
+        if (pattern.size() > 63)
+            return false;
+        for (std::size_t j = 0; j < pattern.size(); ++j) {
+            std::uint64_t bit = std::uint64_t(1) << j;
+            if (pattern[j] == '*')
+                stars |= bit;
+            else if (pattern[j] == '?')
+                for (auto& a : accepts)
+                    a |= bit;
+            else
+                accepts[(unsigned char)pattern[j]] |= bit;
+        }
+        final = std::uint64_t(1) << pattern.size();
+        start = closure(1);
+        return true;
+    }
+
+    // A * can match nothing, so reaching one also reaches the position after it
+    std::uint64_t closure(std::uint64_t state) const {
+        for (std::uint64_t next; (next = state | ((state & stars) << 1)) != state;)
+            state = next;
+        return state;
+    }
+
+    std::uint64_t step(std::uint64_t state, unsigned char c) const {
+        return closure(((state & accepts[c]) << 1) | (state & stars));
+    }
+
+    std::uint64_t feed(std::uint64_t state, std::string_view text) const {
+        for (char ch : text) {
+            if (!state)
+                break;
+            state = step(state, (unsigned char)ch);
+        }
+        return state;
+    }
+};
+
+enum class QueryField : std::uint8_t { Size, Mtime, Type, Ext, Depth, Glob };
+enum class QueryOp : std::uint8_t { Compare, And, Or, Not };
+enum class Cmp : std::uint8_t { Lt, Le, Gt, Ge, Eq, Ne };
+
+struct QueryInstr {
+    QueryOp op = QueryOp::Compare;
+    QueryField field = QueryField::Size;
+    Cmp cmp = Cmp::Eq;
+    std::int64_t value = 0;         // for globs, the index of the glob's bit column
+};
+
+struct GlobTerm {
+    Glob glob;
+    bool path = false;              // match the whole path rather than the name
+};
+
+// A compiled expression
+struct Query {
+    std::vector<QueryInstr> program;    // postfix
+    std::vector<GlobTerm> globs;
+    std::vector<std::string> extensions;    // ext values, resolved per tree
+    int depth = 0;                      // stack words the program needs
+};
+
+// Recursive-descent compiler; on failure error says what went wrong
+class QueryCompiler {
+public:
+    QueryCompiler(const std::string& text, std::int64_t now) : m_text(text), m_now(now) {}
+
+    bool compile(Query& query, std::string& error) {
+        m_query = &query;
+        query = Query();
+        next();
+        if (!parseOr() || (m_token.kind != Token::End && fail("unexpected '" + m_token.text + "'"))) {
+            error = m_error;
+            return false;
+        }
+        int depth = 0;
+        for (const QueryInstr& in : query.program) {
+            depth += in.op == QueryOp::Compare ? 1 : in.op == QueryOp::Not ? 0 : -1;
+            query.depth = std::max(query.depth, depth);
+        }
+        return true;
+    }
+
+private:
+    struct Token {
+        enum Kind { End, Word, String, Op, Open, Close } kind = End;
+        std::string text;
+    };
+
+    void next() {
+        while (m_pos < m_text.size() && std::isspace((unsigned char)m_text[m_pos]))
+            ++m_pos;
+        m_token = Token();
+        if (m_pos == m_text.size())
+            return;
+        char c = m_text[m_pos];
+        if (c == '(' || c == ')') {
+            m_token.kind = c == '(' ? Token::Open : Token::Close;
+            m_token.text = c;
+            ++m_pos;
+        } else if (c == '"' || c == '\'') {
+            std::size_t end = m_text.find(c, m_pos + 1);
+            m_token.kind = Token::String;
+            m_token.text = m_text.substr(m_pos + 1, end == std::string::npos ? end : end - m_pos - 1);
+            m_pos = end == std::string::npos ? m_text.size() : end + 1;
+        } else if (std::strchr("<>=!~", c)) {
+            m_token.kind = Token::Op;
+            m_token.text = c;
+            if (++m_pos < m_text.size() && m_text[m_pos] == '=' && c != '~') {
+                m_token.text += '=';
+                ++m_pos;
+            }
+        } else {
+            m_token.kind = Token::Word;
+            while (m_pos < m_text.size() && !std::isspace((unsigned char)m_text[m_pos]) &&
+                   !std::strchr("()<>=!~\"'", m_text[m_pos]))
+                m_token.text += m_text[m_pos++];
+        }
+    }
+
+    bool fail(const std::string& message) {
+        if (m_error.empty())
+            m_error = message;
+        return false;
+    }
+
+    void emit(QueryOp op) {
+        QueryInstr in;
+        in.op = op;
+        m_query->program.push_back(in);
+    }
+
+    bool parseOr() {
+        if (!parseAnd())
+            return false;
+        while (m_token.kind == Token::Word && m_token.text == "or") {
+            next();
+            if (!parseAnd())
+                return false;
+            emit(QueryOp::Or);
+        }
+        return true;
+    }
+
+    bool parseAnd() {
+        if (!parseNot())
+            return false;
+        while (m_token.kind == Token::Word && m_token.text == "and") {
+            next();
+            if (!parseNot())
+                return false;
+            emit(QueryOp::And);
+        }
+        return true;
+    }
+
+    bool parseNot() {
+        if (m_token.kind == Token::Word && m_token.text == "not") {
+            next();
+            if (!parseNot())
+                return false;
+            emit(QueryOp::Not);
+            return true;
+        }
+        if (m_token.kind == Token::Open) {
+            next();
+            if (!parseOr())
+                return false;
+            if (m_token.kind != Token::Close)
+                return fail("missing ')'");
+            next();
+            return true;
+        }
+        return parseTerm();
+    }
+
+    bool parseTerm() {
+        if (m_token.kind != Token::Word)
+            return fail(m_token.kind == Token::End ? "expression ends early" : "expected a field");
+        std::string field = m_token.text;
+        next();
+        if (m_token.kind != Token::Op)
+            return fail("expected an operator after '" + field + "'");
+        std::string op = m_token.text;
+        next();
+        if (m_token.kind != Token::Word && m_token.kind != Token::String)
+            return fail("expected a value after '" + field + " " + op + "'");
+        std::string value = m_token.text;
+        next();
+
+        QueryInstr in;
+        if (field == "name" || field == "path") {
+            if (op != "~")
+                return fail(field + " only takes ~");
+            GlobTerm term;
+            term.path = field == "path";
+            if (!term.glob.compile(value))
+                return fail("glob longer than 63 characters");
+            in.field = QueryField::Glob;
+            in.value = std::int64_t(m_query->globs.size());
+            m_query->globs.push_back(term);
+            m_query->program.push_back(in);
+            return true;
+        }
+
+        static const std::pair<const char*, Cmp> ops[] = {
+            { "<", Cmp::Lt }, { "<=", Cmp::Le }, { ">", Cmp::Gt }, { ">=", Cmp::Ge },
+            { "=", Cmp::Eq }, { "!=", Cmp::Ne } };
+        auto found = std::find_if(std::begin(ops), std::end(ops), [&](auto& o) { return op == o.first; });
+        if (found == std::end(ops))
+            return fail("unknown operator '" + op + "'");
+        in.cmp = found->second;
+
+        if (field == "size") {
+            in.field = QueryField::Size;
+            if (!parseNumber(value, "KMGT", { 1024.0, 1048576.0, 1073741824.0, 1099511627776.0 }, in.value))
+                return fail("bad size '" + value + "'");
+        } else if (field == "age") {
+            // An age is an mtime the other way round
+            std::int64_t seconds;
+            if (!parseNumber(value, "smhdwy", { 1.0, 60.0, 3600.0, 86400.0, 604800.0, 31557600.0 },
+                             seconds, 86400.0))
+                return fail("bad age '" + value + "'");
+            in.field = QueryField::Mtime;
+            in.value = m_now - seconds;
+            static const Cmp flipped[] = { Cmp::Gt, Cmp::Ge, Cmp::Lt, Cmp::Le, Cmp::Eq, Cmp::Ne };
+            in.cmp = flipped[int(in.cmp)];
+        } else if (field == "mtime") {
+            in.field = QueryField::Mtime;
+            if (!parseTime(value, in.value))
+                return fail("bad time '" + value + "'");
+        } else if (field == "depth") {
+            in.field = QueryField::Depth;
+            if (!parseNumber(value, "", {}, in.value))
+                return fail("bad depth '" + value + "'");
+        } else if (field == "type") {
+            in.field = QueryField::Type;
+            if (value == "file")       in.value = std::int64_t(NodeType::File);
+            else if (value == "dir")   in.value = std::int64_t(NodeType::Directory);
+            else if (value == "link")  in.value = std::int64_t(NodeType::Symlink);
+            else if (value == "other") in.value = std::int64_t(NodeType::Other);
+            else return fail("unknown type '" + value + "'");
+        } else if (field == "ext") {
+            if (in.cmp != Cmp::Eq && in.cmp != Cmp::Ne)
+                return fail("ext only takes = and !=");
+            in.field = QueryField::Ext;
+            if (!value.empty() && value[0] == '.')
+                value.erase(0, 1);
+            for (char& ch : value)
+                if (ch >= 'A' && ch <= 'Z')
+                    ch = char(ch - 'A' + 'a');
+            in.value = std::int64_t(m_query->extensions.size());
+            m_query->extensions.push_back(value);
+        } else {
+            return fail("unknown field '" + field + "'");
+        }
+        m_query->program.push_back(in);
+        return true;
+    }
+
+    // A number with an optional unit letter (and anything after it, as in
+    // "GiB"); scale applies when there is no unit
+    static bool parseNumber(const std::string& text, const char* units, std::vector<double> factors,
+                            std::int64_t& out, double scale = 1.0) {
+        char* end;
+        double value = std::strtod(text.c_str(), &end);
+        if (end == text.c_str())
+            return false;
+        if (*end) {
+            const char* unit = std::strchr(units, *end);
+            if (!*units || !unit)
+                return false;
+            scale = factors[std::size_t(unit - units)];
+            std::string rest = end + 1;
+            if (!rest.empty() && rest != "B" && rest != "iB")
+                return false;
+        }
+        out = std::int64_t(value * scale);
+        return true;
+    }
+
+    static bool parseTime(const std::string& text, std::int64_t& out) {
+        int y, m, d;
+        char tail;
+        if (std::sscanf(text.c_str(), "%d-%d-%d%c", &y, &m, &d, &tail) == 3) {
+            // Days since the epoch, from Howard Hinnant's days_from_civil
+            y -= m <= 2;
+            int era = (y >= 0 ? y : y - 399) / 400;
+            unsigned yoe = unsigned(y - era * 400);
+            unsigned doy = unsigned((153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1);
+            unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+            out = (std::int64_t(era) * 146097 + std::int64_t(doe) - 719468) * 86400;
+            return true;
+        }
+        return parseNumber(text, "", {}, out);
+    }
+
+    const std::string& m_text;
+    std::int64_t m_now;
+    std::size_t m_pos = 0;
+    Token m_token;
+    Query* m_query = nullptr;
+    std::string m_error;
+};
+
+// Match bits per column index, and per subtree
+struct FilterResult {
+    std::vector<std::uint64_t> matches;
+    std::vector<std::uint64_t> subtree;     // the node or one of its descendants matches
+    std::uint64_t count = 0;
+    std::uint64_t generation = 0;
+
+    static bool test(const std::vector<std::uint64_t>& bits, const FileNode& node) {
+        return (bits[node.column >> 6] >> (node.column & 63)) & 1;
+    }
+    bool matched(const FileNode& node) const { return test(matches, node); }
+    bool anyMatched(const FileNode& node) const { return test(subtree, node); }
+};
+
+// Bits for 64 column values from a comparison with a constant
+template <typename T>
+std::uint64_t compareWord(const T* values, std::size_t n, Cmp cmp, T v) {
+    std::uint64_t word = 0;
+    auto bits = [&](auto pred) {
+        for (std::size_t i = 0; i < n; ++i)
+            word |= std::uint64_t(pred(values[i])) << i;
+    };
+    switch (cmp) {
+        case Cmp::Lt: bits([v](T x) { return x < v; });  break;
+        case Cmp::Le: bits([v](T x) { return x <= v; }); break;
+        case Cmp::Gt: bits([v](T x) { return x > v; });  break;
+        case Cmp::Ge: bits([v](T x) { return x >= v; }); break;
+        case Cmp::Eq: bits([v](T x) { return x == v; }); break;
+        case Cmp::Ne: bits([v](T x) { return x != v; }); break;
+    }
+    return word;
+}
+
+// Run a query over a tree's columns
+void runQuery(const Query& query, const NodeColumns& columns, FilterResult& result) {
+    TRACE_ZONE("runQuery");
+    static std::uint64_t generations = 0;
+    const std::size_t count = columns.size();
+    const std::size_t words = (count + 63) / 64;
+
+    // Globs depend on the path, so they are carried down the tree: a
+    // node's state continues from its parent's, which comes first in
+    // pre-order. Each chunk of words starts from the states of its first
+    // node's ancestors and keeps states only for the directories on the
+    // current path, so chunks run independently.
+    std::vector<std::vector<std::uint64_t>> globBits(query.globs.size());
+    if (!query.globs.empty()) {
+        TRACE_ZONE("globs");
+        for (auto& bits : globBits)
+            bits.assign(words, 0);
+        parallelChunks(words, [&](std::size_t beginWord, std::size_t endWord) {
+            const std::size_t begin = beginWord * 64, end = std::min(count, endWord * 64);
+            auto nameOf = [&](std::size_t i) {
+                const FileNode& node = *columns.nodes[i];
+                return std::string_view(node.name.data(), node.name.size());
+            };
+            // Ancestors of the chunk's first node, outermost first
+            std::vector<std::uint32_t> chain;
+            for (std::size_t i = begin; i != 0;) {
+                i = columns.parents[i];
+                chain.push_back(std::uint32_t(i));
+            }
+            std::reverse(chain.begin(), chain.end());
+            // Column and state of each directory on the path to the current node
+            std::vector<std::pair<std::uint32_t, std::uint64_t>> path;
+            for (std::size_t g = 0; g < query.globs.size(); ++g) {
+                const GlobTerm& term = query.globs[g];
+                const Glob& glob = term.glob;
+                std::uint64_t* bits = globBits[g].data();
+                path.clear();
+                if (term.path)
+                    for (std::uint32_t a : chain)
+                        path.push_back({ a, glob.feed(path.empty() ? glob.start : glob.step(path.back().second, '/'),
+                                                      nameOf(a)) });
+                for (std::size_t i = begin; i < end; ++i) {
+                    std::uint64_t state;
+                    if (term.path) {
+                        while (!path.empty() && path.back().first != columns.parents[i])
+                            path.pop_back();
+                        state = glob.feed(i ? glob.step(path.back().second, '/') : glob.start, nameOf(i));
+                        if (!columns.nodes[i]->children.empty())
+                            path.push_back({ std::uint32_t(i), state });
+                    } else {
+                        state = glob.feed(glob.start, nameOf(i));
+                    }
+                    if (state & glob.final)
+                        bits[i >> 6] |= std::uint64_t(1) << (i & 63);
+                }
+            }
+        }, 64);
+    }
+
+    // Extensions named in the query, as interned ids; an empty one is "none"
+    std::vector<std::uint32_t> extIds;
+    for (const std::string& ext : query.extensions)
+        extIds.push_back(ext.empty() ? 0 : extensions.find(ext));
+
+    result.matches.assign(words, 0);
+    std::atomic<std::uint64_t> matched{ 0 };
+    parallelChunks(words, [&](std::size_t begin, std::size_t end) {
+        std::vector<std::uint64_t> stack(std::size_t(std::max(1, query.depth)));
+        std::uint64_t local = 0;
+        for (std::size_t w = begin; w < end; ++w) {
+            const std::size_t first = w * 64, n = std::min<std::size_t>(64, count - first);
+            std::size_t top = 0;
+            for (const QueryInstr& in : query.program) {
+                switch (in.op) {
+                    case QueryOp::And: --top; stack[top - 1] &= stack[top]; continue;
+                    case QueryOp::Or:  --top; stack[top - 1] |= stack[top]; continue;
+                    case QueryOp::Not: stack[top - 1] = ~stack[top - 1];   continue;
+                    case QueryOp::Compare: break;
+                }
+                std::uint64_t word = 0;
+                switch (in.field) {
+                    case QueryField::Size:
+                        word = compareWord(columns.sizes.data() + first, n, in.cmp, std::uint64_t(in.value));
+                        break;
+                    case QueryField::Mtime:
+                        word = compareWord(columns.mtimes.data() + first, n, in.cmp, in.value);
+                        break;
+                    case QueryField::Type:
+                        word = compareWord(columns.types.data() + first, n, in.cmp, std::uint8_t(in.value));
+                        break;
+                    case QueryField::Ext:
+                        word = compareWord(columns.exts.data() + first, n, in.cmp, extIds[std::size_t(in.value)]);
+                        break;
+                    case QueryField::Depth:
+                        word = compareWord(columns.depths.data() + first, n, in.cmp,
+                                           std::uint16_t(std::min<std::int64_t>(std::max<std::int64_t>(in.value, 0), 0xFFFF)));
+                        break;
+                    case QueryField::Glob:
+                        word = globBits[std::size_t(in.value)][w];
+                        break;
+                }
+                stack[top++] = word;
+            }
+            std::uint64_t bits = stack[0] & (n == 64 ? ~std::uint64_t(0) : (std::uint64_t(1) << n) - 1);
+            result.matches[w] = bits;
+            local += std::uint64_t(std::bitset<64>(bits).count());
+        }
+        matched += local;
+    }, 64);
+    result.count = matched;
+
+    // Children come after their parents, so one backward pass carries
+    // matches up to every ancestor
+    result.subtree = result.matches;
+    for (std::size_t i = count; i-- > 1;)
+        if ((result.subtree[i >> 6] >> (i & 63)) & 1) {
+            std::uint32_t p = columns.parents[i];
+            result.subtree[p >> 6] |= std::uint64_t(1) << (p & 63);
+        }
+    result.generation = ++generations;
+}
+
+struct Palette;
+
+// What a frame of the tree view shows
+struct FrameState {
+    FileNode* focus = nullptr;
+    const FileNode* selected = nullptr;
+    WorldPos camera;
+    float zoom = 1.f;
+    bool drawLabels = false;
+    // With more than one, the versions of a snapshot store being scrubbed
+    const std::vector<std::int64_t>* versionTimes = nullptr;
+    std::size_t version = 0;
+    // With a --filter, which nodes match it; the rest are dimmed, or hidden
+    // along with subtrees that have no match
+    const FilterResult* filter = nullptr;
+    bool hideUnmatched = false;
+    // Which of the top lists to show, if any
+    const TopReport* top = nullptr;
+    int topList = -1;
+    std::shared_ptr<const Palette> palette;     // null for plain edge colours
+};
+
+typedef std::vector<sf::Vertex, TaggedAllocator<sf::Vertex, MemText>> TextBuffer;
+
+// A label's run of vertices in the label buffer, and the world position
+// they are centred on
+struct LabelSpan {
+    WorldPos anchor;
+    std::uint32_t first, count;
+};
+
+// Path from the root down to the focused node, drawn in screen space
+struct Breadcrumbs {
+    std::vector<sf::Text> texts;
+    std::vector<std::pair<sf::FloatRect, FileNode*>> hits;    // clickable segments
+};
+
+// Version slider under the breadcrumbs, drawn in screen space
+struct TimeSlider {
+    std::vector<sf::Vertex> quads;  // track, one tick per version and the handle
+    sf::Text label;
+    sf::FloatRect track;            // clickable area
+    std::size_t versions = 0;
+
+    // Version under a window x coordinate
+    std::size_t versionAt(float x) const {
+        if (versions < 2)
+            return 0;
+        float t = (x - track.left) / track.width;
+        return std::size_t(std::min(1.f, std::max(0.f, t)) * (versions - 1) + 0.5f);
+    }
+};
+
+// One of the top lists, drawn in screen space at the right of the window
+struct TopPanel {
+    std::vector<sf::Vertex> quads;  // background
+    std::vector<sf::Text> texts;
+    std::vector<std::pair<sf::FloatRect, FileNode*>> hits;    // clickable lines
+};
+
+// Everything the renderer needs to draw the tree, copied out of it so the
+// renderer never reads nodes that the event thread may be changing. Built
+// by buildSnapshot when the layout, focus, selection, label mode or window
+// width changes; immutable once handed to the renderer.
+struct SceneSnapshot {
+    std::vector<WorldPos, TaggedAllocator<WorldPos, MemVertices>> edgePoints;    // two per edge
+    std::vector<sf::Color, TaggedAllocator<sf::Color, MemVertices>> edgeColors;  // one per point
+    // Per point, the extension and user ids a palette colours it by; 0 keeps its colour
+    std::vector<std::uint32_t, TaggedAllocator<std::uint32_t, MemVertices>> edgeKeys;
+    std::vector<std::uint32_t, TaggedAllocator<std::uint32_t, MemVertices>> edgeOwners;
+    TextBuffer labels;              // positions are unscaled offsets from the span's anchor
+    std::vector<LabelSpan, TaggedAllocator<LabelSpan, MemText>> labelSpans;
+    std::uint64_t visibleNodes = 0;
+    Breadcrumbs breadcrumbs;
+    TimeSlider slider;
+    TopPanel topPanel;
+
+    // What it was built from
+    std::uint64_t generation = 0;
+    std::uint64_t layoutVersion = 0;
+    const FileNode* focus = nullptr;
+    const FileNode* selected = nullptr;
+    bool drawLabels = false;
+    unsigned width = 0;
+    std::size_t version = 0;
+    std::size_t versions = 0;
+    std::uint64_t filterGeneration = 0;
+    bool hideUnmatched = false;
+    int topList = -1;
+};
+
+// The renderer's own vertices for the snapshot it last drew. placeScene
+// only rewrites their positions, when a new snapshot arrives, the zoom
+// changes, or the camera moves far enough from the origin they are
+// relative to; buffer capacity is reused, so a steady-state frame does no
+// heap allocation at all.
+struct RenderBuffers {
+    VertexBuffer edges;
+    TextBuffer labels;
+    std::uint64_t generation = 0;
+    std::uint64_t paletteVersion = 0;   // of the palette the edge colours are from; 0 for none
+    WorldPos origin;
+    float zoom = 0.f;
+};
+
+// Where a byte's glyph goes in a label's local space and in the texture
+struct GlyphQuad {
+    sf::FloatRect rect;
+    sf::FloatRect uv;
+};
+
+// Glyphs for the batched labels. Where shaders work this is a signed
+// distance field of every glyph, rasterised once at SDF_SIZE; the shader
+// cuts both the fill and the outline out of it, sharp at any scale and
+// with one quad per glyph. Otherwise labels use the font's own TEXT_SIZE
+// bitmaps with a second, outline quad per glyph, as sf::Text does.
+class GlyphAtlas {
+public:
+    GlyphAtlas(const sf::Font& font, const std::array<bool, 256>& used, bool allowSdf = true)
+        : m_font(font), m_metrics(font, used) {
+        if (!(allowSdf && sf::Shader::isAvailable() && buildSdf()))
+            buildBitmap();
+        // Breadcrumbs use outlined TEXT_SIZE glyphs too. With every one of
+        // them loaded now, the font's TEXT_SIZE page no longer changes, and
+        // the render thread can draw from it while the event thread reads
+        // the font at that size. Text at any other size adds pages and
+        // resizes the face, so the render thread must not draw any from
+        // this font; the HUD has a font of its own.
+        const sf::Uint32* ansi = ansiCodepoints();
+        for (int c = 0; c < 256; ++c)
+            m_font.getGlyph(ansi[c], TEXT_SIZE, false, LABEL_OUTLINE);
+    }
+
+    const sf::Font& font() const { return m_font; }
+    const LabelMetrics& metrics() const { return m_metrics; }
+    bool isSdf() const { return m_sdf; }
+    const GlyphQuad& fill(unsigned char c) const { return m_fill[c]; }
+    const GlyphQuad& outline(unsigned char c) const { return m_outline[c]; }
+
+    sf::RenderStates states() const {
+        sf::RenderStates states(m_texture);
+        if (m_sdf)
+            states.shader = &m_shader;
+        return states;
+    }
+
+private:
+    void buildBitmap() {
+        const sf::Uint32* ansi = ansiCodepoints();
+        auto quad = [](const sf::Glyph& glyph) {
+            const float padding = 1.f;
+            return GlyphQuad{
+                sf::FloatRect(glyph.bounds.left - padding, glyph.bounds.top - padding,
+                              glyph.bounds.width + 2 * padding, glyph.bounds.height + 2 * padding),
+                sf::FloatRect(glyph.textureRect.left - padding, glyph.textureRect.top - padding,
+                              glyph.textureRect.width + 2 * padding, glyph.textureRect.height + 2 * padding) };
+        };
+        for (int c = 0; c < 256; ++c) {
+            m_fill[c] = quad(m_font.getGlyph(ansi[c], TEXT_SIZE, false));
+            m_outline[c] = quad(m_font.getGlyph(ansi[c], TEXT_SIZE, false, LABEL_OUTLINE));
+        }
+        m_texture = &m_font.getTexture(TEXT_SIZE);
+        m_sdf = false;
+    }
+
+    bool buildSdf() {
+        TRACE_ZONE("buildSdf");
+        const sf::Uint32* ansi = ansiCodepoints();
+        // Rasterise everything before reading the page back, since it may grow
+        for (int c = 0; c < 256; ++c)
+            m_font.getGlyph(ansi[c], SDF_SIZE, false);
+        const sf::Image page = m_font.getTexture(SDF_SIZE).copyToImage();
+
+        // Shelf-pack each glyph with SDF_SPREAD pixels of margin around it
+        struct Cell { int c; sf::IntRect source; unsigned x, y; };
+        std::vector<Cell> cells;
+        const unsigned width = 1024;
+        unsigned x = 0, y = 0, rowHeight = 0;
+        for (int c = 0; c < 256; ++c) {
+            sf::IntRect source = m_font.getGlyph(ansi[c], SDF_SIZE, false).textureRect;
+            if (source.width <= 0 || source.height <= 0)
+                continue;
+            unsigned w = source.width + 2 * SDF_SPREAD, h = source.height + 2 * SDF_SPREAD;
+            if (x + w > width) {
+                x = 0;
+                y += rowHeight;
+                rowHeight = 0;
+            }
+            cells.push_back({ c, source, x, y });
+            x += w;
+            rowHeight = std::max(rowHeight, h);
+        }
+        if (cells.empty())
+            return false;
+
+        // Distance from each atlas pixel to the nearest pixel on the other
+        // side of the glyph's edge, mapped so the edge itself is 0.5
+        sf::Image image;
+        image.create(width, y + rowHeight, sf::Color(255, 255, 255, 0));
+        const sf::Vector2u pageSize = page.getSize();
+        auto inside = [&](const sf::IntRect& source, int px, int py) {
+            if (px < 0 || py < 0 || px >= source.width || py >= source.height ||
+                unsigned(source.left + px) >= pageSize.x || unsigned(source.top + py) >= pageSize.y)
+                return false;
+            return page.getPixel(source.left + px, source.top + py).a >= 128;
+        };
+        parallelChunks(cells.size(), [&](std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i < end; ++i) {
+                const Cell& cell = cells[i];
+                int w = cell.source.width + 2 * SDF_SPREAD, h = cell.source.height + 2 * SDF_SPREAD;
+                for (int oy = 0; oy < h; ++oy) {
+                    for (int ox = 0; ox < w; ++ox) {
+                        int px = ox - SDF_SPREAD, py = oy - SDF_SPREAD;
+                        bool in = inside(cell.source, px, py);
+                        int best = (SDF_SPREAD + 1) * (SDF_SPREAD + 1);
+                        for (int dy = -SDF_SPREAD; dy <= SDF_SPREAD; ++dy)
+                            for (int dx = -SDF_SPREAD; dx <= SDF_SPREAD; ++dx)
+                                if (dx * dx + dy * dy < best && inside(cell.source, px + dx, py + dy) != in)
+                                    best = dx * dx + dy * dy;
+                        float distance = std::sqrt(float(best)) - 0.5f;
+                        float value = 0.5f + (in ? distance : -distance) / (2.f * SDF_SPREAD);
+                        value = std::min(1.f, std::max(0.f, value));
+                        image.setPixel(cell.x + ox, cell.y + oy,
+                                       sf::Color(255, 255, 255, sf::Uint8(value * 255.f + 0.5f)));
+                    }
+                }
+            }
+        }, 1);
+
+        // The outline is LABEL_OUTLINE label pixels outside the fill's edge
+        const float scale = float(TEXT_SIZE) / SDF_SIZE;
+        const float outlineEdge = 0.5f - std::abs(LABEL_OUTLINE) / scale / (2.f * SDF_SPREAD);
+        static const char* fragment =
+            "uniform sampler2D atlas;\n"
+            "uniform float outlineEdge;\n"
+            "void main() {\n"
+            "    float d = texture2D(atlas, gl_TexCoord[0].xy).a;\n"
+            "    float w = max(fwidth(d) * 0.5, 0.001);\n"
+            "    float fill = smoothstep(0.5 - w, 0.5 + w, d);\n"
+            "    float shape = smoothstep(outlineEdge - w, outlineEdge + w, d);\n"
+            "    gl_FragColor = vec4(gl_Color.rgb * fill, gl_Color.a * shape);\n"
+            "}\n";
+        if (!m_sdfTexture.loadFromImage(image) || !m_shader.loadFromMemory(fragment, sf::Shader::Fragment))
+            return false;
+        m_sdfTexture.setSmooth(true);
+        m_shader.setUniform("atlas", sf::Shader::CurrentTexture);
+        m_shader.setUniform("outlineEdge", outlineEdge);
+
+        for (const Cell& cell : cells) {
+            const sf::Glyph& glyph = m_font.getGlyph(ansi[cell.c], SDF_SIZE, false);
+            m_fill[cell.c] = GlyphQuad{
+                sf::FloatRect((glyph.bounds.left - SDF_SPREAD) * scale, (glyph.bounds.top - SDF_SPREAD) * scale,
+                              (glyph.bounds.width + 2 * SDF_SPREAD) * scale,
+                              (glyph.bounds.height + 2 * SDF_SPREAD) * scale),
+                sf::FloatRect(float(cell.x), float(cell.y), float(cell.source.width + 2 * SDF_SPREAD),
+                              float(cell.source.height + 2 * SDF_SPREAD)) };
+        }
+        m_texture = &m_sdfTexture;
+        m_sdf = true;
+        return true;
+    }
+
+    const sf::Font& m_font;
+    LabelMetrics m_metrics;
+    GlyphQuad m_fill[256] = {};
+    GlyphQuad m_outline[256] = {};
+    sf::Texture m_sdfTexture;
+    sf::Shader m_shader;
+    const sf::Texture* m_texture = nullptr;
+    bool m_sdf = false;
+};
+
+// Append one label's glyph quads, centred on its node and unscaled, laid
+// out like sf::Text: outline quads first, if any, then the fill on top
+void appendLabel(SceneSnapshot& scene, const GlyphAtlas& atlas, const FileNode& node,
+                 std::string_view text, std::string_view suffix = {},
+                 sf::Color color = sf::Color::White) {
+    const LabelMetrics& metrics = atlas.metrics();
+    auto isSpace = [](unsigned char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; };
+    std::size_t glyphs = 0;
+    for (std::string_view part : { text, suffix })
+        for (char ch : part)
+            glyphs += !isSpace((unsigned char)ch);
+
+    const std::size_t passes = atlas.isSdf() ? 1 : 2;
+    const std::size_t first = scene.labels.size();
+    scene.labels.resize(first + glyphs * 6 * passes);
+    sf::Vertex* outline = scene.labels.data() + first;
+    sf::Vertex* fill = outline + glyphs * 6 * (passes - 1);
+
+    auto quad = [](sf::Vertex*& v, float x, float y, const GlyphQuad& glyph, sf::Color color) {
+        float left = x + glyph.rect.left, right = left + glyph.rect.width;
+        float top = y + glyph.rect.top, bottom = top + glyph.rect.height;
+        float u1 = glyph.uv.left, u2 = u1 + glyph.uv.width;
+        float v1 = glyph.uv.top, v2 = v1 + glyph.uv.height;
+        v[0] = sf::Vertex({ left, top }, color, { u1, v1 });
+        v[1] = sf::Vertex({ right, top }, color, { u2, v1 });
+        v[2] = sf::Vertex({ left, bottom }, color, { u1, v2 });
+        v[3] = sf::Vertex({ left, bottom }, color, { u1, v2 });
+        v[4] = sf::Vertex({ right, top }, color, { u2, v1 });
+        v[5] = sf::Vertex({ right, bottom }, color, { u2, v2 });
+        v += 6;
+    };
+
+    float x = 0.f, y = float(TEXT_SIZE);
+    float minX = float(TEXT_SIZE), minY = float(TEXT_SIZE), maxX = 0.f, maxY = 0.f;
+    unsigned char prev = 0;
+    for (std::string_view part : { text, suffix }) {
+        for (char ch : part) {
+            unsigned char c = (unsigned char)ch;
+            if (c == '\r')
+                continue;
+            x += metrics.kerning[prev * 256 + c];
+            prev = c;
+            if (isSpace(c)) {
+                minX = std::min(minX, x);
+                minY = std::min(minY, y);
+                x = c == '\n' ? 0.f : x + metrics.advance[' '] * (c == '\t' ? 4 : 1);
+                maxX = std::max(maxX, x);
+                maxY = std::max(maxY, y);
+                continue;
+            }
+            if (passes == 2)
+                quad(outline, x, y, atlas.outline(c), sf::Color::Black);
+            quad(fill, x, y, atlas.fill(c), color);
+            minX = std::min(minX, x + metrics.left[c]);
+            maxX = std::max(maxX, x + metrics.right[c]);
+            minY = std::min(minY, y + metrics.top[c]);
+            maxY = std::max(maxY, y + metrics.bottom[c]);
+            x += metrics.advance[c];
+        }
+    }
+
+    sf::Vector2f centre((minX + maxX) / 2.f, (minY + maxY) / 2.f);
+    for (std::size_t i = first; i < scene.labels.size(); ++i)
+        scene.labels[i].position -= centre;
+    scene.labelSpans.push_back({ WorldPos(node.x, node.y), std::uint32_t(first),
+                                 std::uint32_t(glyphs * 6 * passes) });
+}
+
+// Lay out the breadcrumb texts; drops leading segments until the rest fits
+// the window
+void layoutBreadcrumbs(Breadcrumbs& crumbs, FileNode& focus, const sf::Font& font, unsigned width) {
+    std::vector<FileNode*> path;
+    for (FileNode* n = &focus; n; n = n->parent)
+        path.push_back(n);
+    std::reverse(path.begin(), path.end());
+
+    const float margin = 6.f;
+    const float maxWidth = width - 2 * margin;
+    std::vector<sf::Text> texts;
+    float total = 0.f;
+    for (std::size_t i = 0; i < path.size(); ++i) {
+        std::string str = path[i]->name.c_str();
+        if (i + 1 < path.size())
+            str += " / ";
+        texts.emplace_back(str, font, TEXT_SIZE);
+        total += texts.back().getLocalBounds().width;
+    }
+    sf::Text ellipsis(".. / ", font, TEXT_SIZE);
+    std::size_t first = 0;
+    while (first + 1 < path.size() &&
+           total + (first ? ellipsis.getLocalBounds().width : 0.f) > maxWidth)
+        total -= texts[first++].getLocalBounds().width;
+
+    crumbs.texts.clear();
+    crumbs.hits.clear();
+    float x = margin;
+    auto place = [&](sf::Text text, FileNode* target) {
+        sf::FloatRect bounds = text.getLocalBounds();
+        text.setOutlineThickness(LABEL_OUTLINE);
+        text.setOutlineColor(sf::Color::Black);
+        text.setFillColor(sf::Color::White);
+        text.setOrigin(bounds.left + bounds.width / 2.f, bounds.top + bounds.height / 2.f);
+        text.setPosition(x + bounds.width / 2.f, margin + TEXT_SIZE / 2.f);
+        // Build the glyph geometry here, so drawing it needs no font lookups
+        text.getLocalBounds();
+        if (target)
+            crumbs.hits.push_back({ sf::FloatRect(x, margin, bounds.width, float(TEXT_SIZE)), target });
+        crumbs.texts.push_back(text);
+        x += bounds.width;
+    };
+    if (first)
+        place(ellipsis, nullptr);
+    for (std::size_t i = first; i < path.size(); ++i)
+        place(texts[i], path[i]);
+}
+
+// Lay out the version slider: the version and its date on the left, then a
+// track with a tick per version and a handle on the current one
+void layoutTimeSlider(TimeSlider& slider, const std::vector<std::int64_t>& times,
+                      std::size_t version, const sf::Font& font, unsigned width) {
+    const float margin = 6.f, top = margin + TEXT_SIZE + 10.f, height = 14.f;
+    slider.quads.clear();
+    slider.versions = times.size();
+
+    char date[32] = "";
+    std::time_t t = std::time_t(times[version]);
+    if (const std::tm* local = std::localtime(&t))
+        std::strftime(date, sizeof(date), "%Y-%m-%d %H:%M", local);
+    char str[64];
+    std::snprintf(str, sizeof(str), "%zu/%zu  %s", version + 1, times.size(), date);
+    slider.label = sf::Text(str, font, TEXT_SIZE);
+    slider.label.setOutlineThickness(LABEL_OUTLINE);
+    slider.label.setOutlineColor(sf::Color::Black);
+    slider.label.setFillColor(sf::Color::White);
+    sf::FloatRect bounds = slider.label.getLocalBounds();
+    slider.label.setOrigin(bounds.left, bounds.top + bounds.height / 2.f);
+    slider.label.setPosition(margin, top + height / 2.f);
+
+    float left = margin * 3 + bounds.width, right = std::max(left + 1.f, width - margin * 3);
+    slider.track = sf::FloatRect(left, top, right - left, height);
+    auto quad = [&](float x, float y, float w, float h, sf::Color color) {
+        sf::Vector2f a(x, y), b(x + w, y), c(x, y + h), d(x + w, y + h);
+        for (sf::Vector2f p : { a, b, c, c, b, d })
+            slider.quads.emplace_back(p, color);
+    };
+    quad(left, top + height / 2.f - 1.f, right - left, 2.f, sf::Color(150, 150, 150));
+    for (std::size_t v = 0; v < times.size(); ++v) {
+        float x = left + (right - left) * v / float(times.size() - 1);
+        quad(x - 0.5f, top + 3.f, 1.f, height - 6.f, sf::Color(150, 150, 150));
+    }
+    float x = left + (right - left) * version / float(times.size() - 1);
+    quad(x - 4.f, top, 8.f, height, sf::Color::White);
+}
+
+// Lay out a top list as a panel down the right half of the window, below
+// the slider: a title, then one line per entry with its measure and its
+// path, cut from the left to fit
+void layoutTopPanel(TopPanel& panel, const TopReport& report, int kind, const sf::Font& font,
+                    unsigned width) {
+    const float margin = 6.f, top = margin + TEXT_SIZE + 34.f, lineHeight = TEXT_SIZE + 4.f;
+    const float left = width / 2.f, maxWidth = width - left - 2 * margin;
+    const auto& entries = report.lists[kind].entries;
+    const std::size_t lines = std::min<std::size_t>(TOP_COUNT, entries.size());
+
+    sf::Vector2f a(left, top), b(float(width), top), c(left, top + lineHeight * (lines + 1) + margin),
+        d(float(width), c.y);
+    for (sf::Vector2f p : { a, b, c, c, b, d })
+        panel.quads.emplace_back(p, sf::Color(0, 0, 0, 190));
+
+    auto place = [&](const std::string& str, std::size_t line, sf::Color color) {
+        sf::Text text(str, font, TEXT_SIZE);
+        // Drop leading characters of the path until the line fits
+        std::size_t cut = 0, keep = str.find("  ");
+        while (text.getLocalBounds().width > maxWidth && keep != std::string::npos &&
+               keep + 2 + cut + 4 < str.size()) {
+            cut += 4;
+            text.setString(str.substr(0, keep + 2) + ".." + str.substr(keep + 2 + cut));
+        }
+        sf::FloatRect bounds = text.getLocalBounds();
+        text.setOutlineThickness(LABEL_OUTLINE);
+        text.setOutlineColor(sf::Color::Black);
+        text.setFillColor(color);
+        text.setOrigin(bounds.left, bounds.top);
+        text.setPosition(left + margin, top + margin / 2.f + lineHeight * line);
+        text.getLocalBounds();
+        panel.texts.push_back(text);
+    };
+    place(std::string(topKindNames[kind]) + "  (T for the next list)", 0, sf::Color(150, 150, 150));
+    for (std::size_t i = 0; i < lines; ++i) {
+        place(formatTopKey(kind, entries[i].first) + "  " + treePath(*entries[i].second), i + 1,
+              sf::Color::White);
+        panel.hits.push_back({ sf::FloatRect(left, top + lineHeight * (i + 1), width - left, lineHeight),
+                               entries[i].second });
+    }
+}
+
+// A bright colour for the i-th of any number of categories; successive
+// hues are a golden-ratio turn apart, so neighbours never look alike
+sf::Color categoryColor(std::uint32_t i) {
+    double hue = std::fmod(i * 0.618033988749895, 1.0) * 6.0;
+    double f = hue - std::floor(hue);
+    const double v = 1.0, s = 0.65;
+    double p = v * (1 - s), q = v * (1 - s * f), t = v * (1 - s * (1 - f));
+    double r, g, b;
+    switch (int(hue)) {
+        case 0:  r = v; g = t; b = p; break;
+        case 1:  r = q; g = v; b = p; break;
+        case 2:  r = p; g = v; b = t; break;
+        case 3:  r = p; g = q; b = v; break;
+        case 4:  r = t; g = p; b = v; break;
+        default: r = v; g = p; b = q; break;
+    }
+    return sf::Color(sf::Uint8(r * 255), sf::Uint8(g * 255), sf::Uint8(b * 255));
+}
+
+// Colour of a diff-mode change; growth and shrinkage are brighter the
+// more bytes changed, reaching full strength at 1 GB
+sf::Color changeColor(const FileNode& node) {
+    sf::Color base;
+    switch (node.change) {
+        case ChangeKind::Added:    return sf::Color(80, 230, 80);
+        case ChangeKind::Removed:  return sf::Color(240, 70, 70);
+        case ChangeKind::Modified: return sf::Color(230, 220, 80);
+        case ChangeKind::Grown:    base = sf::Color(255, 150, 40); break;
+        case ChangeKind::Shrunk:   base = sf::Color(70, 160, 255); break;
+        default:                   return sf::Color(110, 110, 110);
+    }
+    double t = 0.35 + 0.65 * std::min(1.0, std::log10(1.0 + std::abs(double(node.sizeDelta))) / 9.0);
+    auto blend = [t](sf::Uint8 c) { return sf::Uint8(110 + (c - 110) * t); };
+    return sf::Color(blend(base.r), blend(base.g), blend(base.b));
+}
+
+// Colour a node's label and incoming edge are drawn in: duplicate files
+// stand out in their set's colour, and in diff mode everything is coloured
+// by how it changed. Nodes a filter does not match are faded.
+sf::Color nodeColor(const FileNode& node, const FilterResult* filter = nullptr) {
+    sf::Color color = node.duplicateSet ? categoryColor(node.duplicateSet - 1)
+                    : diffMode          ? changeColor(node)
+                                        : sf::Color::White;
+    if (filter && !filter->matched(node))
+        color.a = 60;
+    return color;
+}
+
+// ---- File types ----
+// C cycles how edges are coloured: plain, by extension (the TYPE_COLORS
+// extensions holding the most bytes each get a colour), by kind of file or
+// by owner (likewise the top users; a directory takes the colour of the
+// user owning most of it). A palette maps extension or owner ids to colours
+// and carries its own legend, and
+// the renderer applies it to the edge vertices' colours alone, so changing
+// it never rebuilds a snapshot or moves a vertex.
+
+// Files and bytes per extension id
+struct TypeHistogram {
+    std::vector<std::uint64_t> counts, bytes;
+};
+
+// Count every file under root by extension, each worker of the walk into
+// its own histogram, merged at the end
+TypeHistogram typeHistogram(FileNode& root) {
+    TRACE_ZONE("typeHistogram");
+    const std::size_t ids = extensions.size();
+    TypeHistogram empty{ std::vector<std::uint64_t>(ids), std::vector<std::uint64_t>(ids) };
+    std::vector<TypeHistogram> parts(std::max(1u, std::thread::hardware_concurrency()), empty);
+    walkPostorderParallel(root, [&parts](FileNode& node, unsigned worker) {
+        if (node.type == NodeType::Directory || node.hardLinkSeen || node.change == ChangeKind::Removed)
+            return;
+        ++parts[worker].counts[node.ext];
+        parts[worker].bytes[node.ext] += node.size;
+    });
+    TypeHistogram total = std::move(empty);
+    for (const TypeHistogram& part : parts)
+        for (std::size_t id = 0; id < ids; ++id) {
+            total.counts[id] += part.counts[id];
+            total.bytes[id] += part.bytes[id];
+        }
+    return total;
+}
+
+// Extension ids ordered by bytes, largest first, leaving out ones with no files
+std::vector<std::uint32_t> rankExtensions(const TypeHistogram& histogram) {
+    std::vector<std::uint32_t> ids;
+    for (std::uint32_t id = 0; id < histogram.counts.size(); ++id)
+        if (histogram.counts[id])
+            ids.push_back(id);
+    std::sort(ids.begin(), ids.end(), [&](std::uint32_t a, std::uint32_t b) {
+        return histogram.bytes[a] != histogram.bytes[b] ? histogram.bytes[a] > histogram.bytes[b] : a < b;
+    });
+    return ids;
+}
+
+void printTypeHistogram(std::ostream& out, const TypeHistogram& histogram, std::size_t count) {
+    std::vector<std::uint32_t> ids = rankExtensions(histogram);
+    out << "File types:\n";
+    char line[96];
+    for (std::size_t i = 0; i < std::min(count, ids.size()); ++i) {
+        std::uint32_t id = ids[i];
+        std::snprintf(line, sizeof(line), "%16s  %10llu files  ", formatBytes(histogram.bytes[id]).c_str(),
+                      (unsigned long long)histogram.counts[id]);
+        out << line << (id ? "." + extensions.names[id] : std::string("(none)")) << '\n';
+    }
+}
+
+// Broad kinds of file, by extension
+enum FileKind { KindOther, KindCode, KindBuild, KindMedia, KindArchive, KindDocument, FileKindCount };
+const char* fileKindNames[FileKindCount] = {
+    "other", "source code", "build output", "media", "archives", "documents"
+};
+const sf::Color fileKindColors[FileKindCount] = {
+    sf::Color(140, 140, 140), sf::Color(90, 200, 255), sf::Color(255, 90, 90),
+    sf::Color(255, 200, 60), sf::Color(200, 120, 255), sf::Color(120, 230, 120)
+};
+
+FileKind fileKind(const std::string& ext) {
+    static const std::unordered_map<std::string, FileKind> kinds = [] {
+        std::unordered_map<std::string, FileKind> map;
+        const std::pair<FileKind, const char*> lists[] = {
+            { KindCode, "c cc cpp cxx h hh hpp hxx inl m mm py js ts jsx tsx java kt rs go rb cs swift "
+                        "php pl lua sh bat ps1 cmake glsl hlsl" },
+            { KindBuild, "o obj a lib so dll dylib exe class jar pyc pyo pdb ilk pch idb exp map wasm" },
+            { KindMedia, "jpg jpeg png gif bmp tga tif tiff webp svg ico psd raw mp3 wav flac ogg m4a aac "
+                         "mp4 mkv avi mov webm wmv m4v" },
+            { KindArchive, "zip gz tgz bz2 xz zst 7z rar tar iso dmg cab lz4 deb rpm" },
+            { KindDocument, "txt md rst pdf doc docx xls xlsx ppt pptx odt ods csv tsv json xml html htm "
+                            "yaml yml toml ini log" },
+        };
+        for (const auto& [kind, names] : lists) {
+            std::istringstream words(names);
+            for (std::string word; words >> word;)
+                map[word] = kind;
+        }
+        return map;
+    }();
+    auto found = kinds.find(ext);
+    return found == kinds.end() ? KindOther : found->second;
+}
+
+enum class PaletteMode { Plain, Extension, Kind, Owner, Count };
+
+// Edge colours by extension or user id, and the legend that explains them. Built
+// on the event thread and immutable afterwards; the render thread draws
+// the legend from it.
+struct Palette {
+    std::vector<sf::Color> colors;  // a colour with alpha 0 leaves the edge's own colour
+    bool byOwner = false;           // colors are indexed by user rather than extension
+    std::vector<sf::Vertex> swatches;
+    std::vector<sf::Text> legend;
+    float legendHeight = 0.f;       // the legend sits this far above the window's bottom edge
+    std::uint64_t version = 0;      // nonzero and unique per palette
+};
+
+// Palette for a mode from a tree's histogram or owner totals, whichever
+// the mode needs; null for plain colours
+std::shared_ptr<const Palette> buildPalette(PaletteMode mode, const TypeHistogram& histogram,
+                                            const OwnerReport& owners, const sf::Font& font) {
+    if (mode == PaletteMode::Plain)
+        return nullptr;
+    static std::uint64_t versions = 0;
+    auto palette = std::make_shared<Palette>();
+    palette->version = ++versions;
+    const sf::Color other(140, 140, 140);
+    palette->colors.assign(extensions.size(), other);
+    palette->colors[0] = sf::Color::Transparent;
+
+    // Legend rows: colour, name and what they add up to
+    struct Row { sf::Color color; std::string name; std::uint64_t count = 0, bytes = 0; };
+    std::vector<Row> rows;
+    if (mode == PaletteMode::Extension) {
+        std::vector<std::uint32_t> ranked = rankExtensions(histogram);
+        Row rest{ other, "other" };
+        for (std::size_t i = 0; i < ranked.size(); ++i) {
+            std::uint32_t id = ranked[i];
+            if (id && rows.size() < TYPE_COLORS) {
+                palette->colors[id] = categoryColor(std::uint32_t(rows.size()));
+                rows.push_back({ palette->colors[id], "." + extensions.names[id],
+                                 histogram.counts[id], histogram.bytes[id] });
+            } else {
+                rest.count += histogram.counts[id];
+                rest.bytes += histogram.bytes[id];
+            }
+        }
+        if (rest.count)
+            rows.push_back(rest);
+    } else if (mode == PaletteMode::Owner) {
+        palette->byOwner = true;
+        palette->colors.assign(users.size(), other);
+        Row rest{ other, "others" };
+        for (const OwnerUsage& u : rankOwners(owners.users)) {
+            if (u.owner && rows.size() < TYPE_COLORS) {
+                palette->colors[u.owner] = categoryColor(std::uint32_t(rows.size()));
+                rows.push_back({ palette->colors[u.owner], ownerName(u.owner, false), u.files, u.bytes });
+            } else {
+                rest.count += u.files;
+                rest.bytes += u.bytes;
+            }
+        }
+        if (rest.count || rest.bytes)
+            rows.push_back(rest);
+    } else {
+        for (int k = 0; k < FileKindCount; ++k)
+            rows.push_back({ fileKindColors[k], fileKindNames[k] });
+        for (std::size_t id = 1; id < extensions.size(); ++id) {
+            FileKind kind = fileKind(extensions.names[id]);
+            palette->colors[id] = fileKindColors[kind];
+            if (id < histogram.counts.size()) {
+                rows[kind].count += histogram.counts[id];
+                rows[kind].bytes += histogram.bytes[id];
+            }
+        }
+        rows[KindOther].count += histogram.counts.empty() ? 0 : histogram.counts[0];
+        rows[KindOther].bytes += histogram.bytes.empty() ? 0 : histogram.bytes[0];
+        std::stable_sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) { return a.bytes > b.bytes; });
+    }
+
+    const float margin = 6.f, lineHeight = TEXT_SIZE + 4.f, swatch = TEXT_SIZE - 6.f;
+    for (std::size_t i = 0; i < rows.size(); ++i) {
+        float y = margin + lineHeight * i;
+        sf::Vector2f a(margin, y + 3.f), b(margin + swatch, y + 3.f), c(margin, y + 3.f + swatch),
+            d(margin + swatch, y + 3.f + swatch);
+        for (sf::Vector2f p : { a, b, c, c, b, d })
+            palette->swatches.emplace_back(p, rows[i].color);
+        char line[96];
+        std::snprintf(line, sizeof(line), "%s  %s in %llu files", rows[i].name.c_str(),
+                      formatBytes(rows[i].bytes).c_str(), (unsigned long long)rows[i].count);
+        sf::Text text(line, font, TEXT_SIZE);
+        sf::FloatRect bounds = text.getLocalBounds();
+        text.setOutlineThickness(LABEL_OUTLINE);
+        text.setOutlineColor(sf::Color::Black);
+        text.setFillColor(sf::Color::White);
+        text.setOrigin(bounds.left, bounds.top);
+        text.setPosition(margin * 2 + swatch, y + 2.f);
+        text.getLocalBounds();
+        palette->legend.push_back(text);
+    }
+    palette->legendHeight = margin * 2 + lineHeight * rows.size();
+    return palette;
+}
+
+// Whether a snapshot no longer shows what state and the window width ask for
+bool snapshotStale(const SceneSnapshot& scene, const FrameState& state, unsigned width) {
+    return scene.generation == 0 || scene.layoutVersion != layoutVersion ||
+           scene.focus != state.focus || scene.selected != state.selected ||
+           scene.drawLabels != state.drawLabels || scene.width != width ||
+           scene.version != state.version ||
+           scene.versions != (state.versionTimes ? state.versionTimes->size() : 0) ||
+           scene.filterGeneration != (state.filter ? state.filter->generation : 0) ||
+           scene.hideUnmatched != state.hideUnmatched || scene.topList != state.topList;
+}
+
+// Copy edges and labels of the visible tree into a snapshot, reusing its
+// buffers
+void buildSnapshot(SceneSnapshot& scene, const FrameState& state, const GlyphAtlas& atlas,
+                   unsigned width) {
+    TRACE_ZONE("buildSnapshot");
+    static std::atomic<std::uint64_t> generations{ 0 };
+    scene.edgePoints.clear();
+    scene.edgeColors.clear();
+    scene.edgeKeys.clear();
+    scene.edgeOwners.clear();
+    scene.labels.clear();
+    scene.labelSpans.clear();
+    scene.visibleNodes = 0;
+
+    const FilterResult* filter = state.filter;
+    const bool hide = filter && state.hideUnmatched;
+    char count[32];
+    walkPreorder(*state.focus, [&](const FileNode& node, int) {
+        if (hide && !filter->anyMatched(node) && &node != state.focus)
+            return false;
+        ++scene.visibleNodes;
+        if (node.collapsed)
+            std::snprintf(count, sizeof(count), state.drawLabels ? " (+%llu)" : "+%llu",
+                          (unsigned long long)node.descendants);
+        // Without labels, collapsed subtrees are still marked with their hidden count
+        if (state.drawLabels)
+            appendLabel(scene, atlas, node, node.name, node.collapsed ? count : "", nodeColor(node, filter));
+        else if (node.collapsed)
+            appendLabel(scene, atlas, node, count);
+        if (node.collapsed)
+            return false;
+        for (auto& c : node.children) {
+            if (hide && !filter->anyMatched(*c))
+                continue;
+            scene.edgePoints.emplace_back(node.x, node.y);
+            scene.edgeColors.push_back(sf::Color(100, 100, 100, 100));
+            scene.edgeKeys.push_back(0);
+            scene.edgeOwners.push_back(0);
+            scene.edgePoints.emplace_back(c->x, c->y);
+            scene.edgeColors.push_back(nodeColor(*c, filter));
+            // Duplicate and change colours win over the palette
+            bool own = !c->duplicateSet && !diffMode;
+            scene.edgeKeys.push_back(own ? c->ext : 0);
+            std::uint32_t owner = c->user;
+            if (c->owners && !c->owners->users.empty() && c->owners->users[0].owner != otherOwners)
+                owner = c->owners->users[0].owner;
+            scene.edgeOwners.push_back(own ? owner : 0);
+        }
+        return true;
+    });
+    if (!state.drawLabels && state.selected) {
+        std::snprintf(count, sizeof(count), " (+%llu)", (unsigned long long)state.selected->descendants);
+        appendLabel(scene, atlas, *state.selected, state.selected->name,
+                    state.selected->collapsed ? count : "", nodeColor(*state.selected, filter));
+    }
+    layoutBreadcrumbs(scene.breadcrumbs, *state.focus, atlas.font(), width);
+    scene.slider.quads.clear();
+    scene.slider.versions = 0;
+    if (state.versionTimes && state.versionTimes->size() > 1)
+        layoutTimeSlider(scene.slider, *state.versionTimes, state.version, atlas.font(), width);
+    scene.topPanel.quads.clear();
+    scene.topPanel.texts.clear();
+    scene.topPanel.hits.clear();
+    if (state.top && state.topList >= 0)
+        layoutTopPanel(scene.topPanel, *state.top, state.topList, atlas.font(), width);
+
+    scene.generation = ++generations;
+    scene.layoutVersion = layoutVersion;
+    scene.focus = state.focus;
+    scene.selected = state.selected;
+    scene.drawLabels = state.drawLabels;
+    scene.width = width;
+    scene.version = state.version;
+    scene.versions = state.versionTimes ? state.versionTimes->size() : 0;
+    scene.filterGeneration = filter ? filter->generation : 0;
+    scene.hideUnmatched = state.hideUnmatched;
+    scene.topList = state.topList;
+}
+
+// Vertex positions for a snapshot at the given origin and zoom
+void placeScene(RenderBuffers& buffers, const SceneSnapshot& scene,
+                const WorldPos& origin, float zoom) {
+    if (buffers.generation != scene.generation) {
+        buffers.edges.resize(scene.edgePoints.size());
+        for (std::size_t i = 0; i < buffers.edges.size(); ++i)
+            buffers.edges[i].color = scene.edgeColors[i];
+        buffers.labels.assign(scene.labels.begin(), scene.labels.end());
+        buffers.generation = scene.generation;
+        buffers.paletteVersion = 0;
+    }
+    buffers.origin = origin;
+    buffers.zoom = zoom;
+    for (std::size_t i = 0; i < buffers.edges.size(); ++i)
+        buffers.edges[i].position = toView(scene.edgePoints[i].x, scene.edgePoints[i].y, origin);
+    for (const LabelSpan& span : scene.labelSpans) {
+        sf::Vector2f anchor = toView(span.anchor.x, span.anchor.y, origin);
+        for (std::uint32_t i = span.first; i < span.first + span.count; ++i)
+            buffers.labels[i].position = anchor + scene.labels[i].position * zoom;
+    }
+}
+
+// Recolour a snapshot's edges with a palette, or with their own colours
+// for none; positions are left alone. A palette colour takes the alpha of
+// the colour it replaces, so filtered-out edges stay faded.
+void colourEdges(RenderBuffers& buffers, const SceneSnapshot& scene, const Palette* palette) {
+    TRACE_ZONE("colourEdges");
+    for (std::size_t i = 0; i < buffers.edges.size(); ++i) {
+        sf::Color color = scene.edgeColors[i];
+        std::uint32_t key = palette && palette->byOwner ? scene.edgeOwners[i] : scene.edgeKeys[i];
+        if (palette && key < palette->colors.size() && palette->colors[key].a) {
+            sf::Uint8 alpha = color.a;
+            color = palette->colors[key];
+            color.a = alpha;
+        }
+        buffers.edges[i].color = color;
+    }
+    buffers.paletteVersion = palette ? palette->version : 0;
+}
+
+// Draw one frame of a snapshot: edges and labels in world space,
+// breadcrumbs on top. Vertices are only moved when something changed since
+// the last frame.
+void renderFrame(sf::RenderTarget& target, const sf::View& worldView, const FrameState& state,
+                 const SceneSnapshot& scene, const GlyphAtlas& atlas, RenderBuffers& buffers) {
+    TRACE_ZONE("renderFrame");
+    frameStats = FrameStats();
+
+    if (buffers.generation != scene.generation) {
+        perfCount(Rebuilds);
+        placeScene(buffers, scene, state.camera, state.zoom);
+    } else {
+        // Rebase before the camera's offset from the origin grows big enough
+        // for float rounding to show at the current zoom
+        double limit = REBASE_DISTANCE * state.zoom;
+        if (state.zoom != buffers.zoom ||
+            std::abs(state.camera.x - buffers.origin.x) > limit ||
+            std::abs(state.camera.y - buffers.origin.y) > limit)
+            placeScene(buffers, scene, state.camera, state.zoom);
+    }
+    const Palette* palette = state.palette.get();
+    if (buffers.paletteVersion != (palette ? palette->version : 0))
+        colourEdges(buffers, scene, palette);
+
+    sf::View view = worldView;
+    view.setCenter(toView(state.camera.x, state.camera.y, buffers.origin));
+    target.clear(sf::Color::Black);
+    target.setView(view);
+    if (!buffers.edges.empty()) {
+        target.draw(buffers.edges.data(), buffers.edges.size(), sf::Lines);
+        countDraw(buffers.edges.size());
+    }
+    if (!buffers.labels.empty()) {
+        target.draw(buffers.labels.data(), buffers.labels.size(), sf::Triangles, atlas.states());
+        countDraw(buffers.labels.size());
+    }
+    perfCount(VisibleNodes, scene.visibleNodes);
+    perfCount(Labels, scene.labelSpans.size());
+
+    target.setView(target.getDefaultView());
+    for (const sf::Text& text : scene.breadcrumbs.texts)
+        target.draw(text);
+    if (!scene.slider.quads.empty()) {
+        target.draw(scene.slider.quads.data(), scene.slider.quads.size(), sf::Triangles);
+        countDraw(scene.slider.quads.size());
+        target.draw(scene.slider.label);
+    }
+    if (!scene.topPanel.quads.empty()) {
+        target.draw(scene.topPanel.quads.data(), scene.topPanel.quads.size(), sf::Triangles);
+        countDraw(scene.topPanel.quads.size());
+    }
+    for (const sf::Text& text : scene.topPanel.texts)
+        target.draw(text);
+    if (palette) {
+        sf::RenderStates legend;
+        legend.transform.translate(0.f, float(target.getSize().y) - palette->legendHeight);
+        target.draw(palette->swatches.data(), palette->swatches.size(), sf::Triangles, legend);
+        countDraw(palette->swatches.size());
+        for (const sf::Text& text : palette->legend)
+            target.draw(text, legend);
+    }
+}
+
+// Hands scene snapshots from the thread that owns the tree to the render
+// thread, read-copy-update style: the writer fills a snapshot nobody else
+// can see and swaps it in atomically, and the reader keeps whatever it
+// loaded for as long as it draws from it. Two snapshots circulate: once
+// the reader has let go of the previous one, the writer refills it in
+// place instead of allocating.
+class SceneExchange {
+public:
+    // A snapshot for the writer to fill
+    std::shared_ptr<SceneSnapshot> beginUpdate() {
+        if (m_previous && m_previous.use_count() == 1)
+            return std::move(m_previous);
+        return std::make_shared<SceneSnapshot>();
+    }
+
+    void publish(std::shared_ptr<SceneSnapshot> scene) {
+        m_previous = std::move(m_latest);
+        m_latest = std::move(scene);
+        std::atomic_store(&m_current, std::shared_ptr<const SceneSnapshot>(m_latest));
+    }
+
+    // The last published snapshot, for the writer
+    const SceneSnapshot* latest() const { return m_latest.get(); }
+
+    // The last published snapshot, for the reader
+    std::shared_ptr<const SceneSnapshot> current() const { return std::atomic_load(&m_current); }
+
+private:
+    std::shared_ptr<const SceneSnapshot> m_current;
+    std::shared_ptr<SceneSnapshot> m_latest;
+    std::shared_ptr<SceneSnapshot> m_previous;
+};
+
+// Heap bytes held by the scanned tree: nodes, names and child arrays
+std::size_t treeBytes() {
+    return std::size_t(memLive(MemNodes) + memLive(MemNames) + memLive(MemChildren));
+}
+
+// Print live/peak bytes per tag, biggest first, plus bytes per node
+void printMemoryReport(std::ostream& out, const char* when, std::uint64_t nodes) {
+    std::vector<int> order;
+    std::int64_t total = 0;
+    for (int t = 0; t < MemTagCount; ++t) {
+        order.push_back(t);
+        total += memLive(MemTag(t));
+    }
+    std::sort(order.begin(), order.end(), [](int a, int b) {
+        return memLive(MemTag(a)) > memLive(MemTag(b));
+    });
+
+    char buf[160];
+    out << "Memory after " << when << ": " << formatBytes(std::uintmax_t(total)) << " live, ";
+    std::snprintf(buf, sizeof(buf), "%.1f bytes/node over %llu nodes\n",
+                  nodes ? double(total) / double(nodes) : 0.0, (unsigned long long)nodes);
+    out << buf;
+    for (int t : order) {
+        const MemStats& stats = memStats[t];
+        std::int64_t live = stats.live.load();
+        std::snprintf(buf, sizeof(buf), "  %-16s %12s live %12s peak %12llu allocs %8.1f B/node\n",
+                      memTagNames[t], formatBytes(std::uintmax_t(live)).c_str(),
+                      formatBytes(std::uintmax_t(stats.peak.load())).c_str(),
+                      (unsigned long long)stats.allocations.load(),
+                      nodes ? double(live) / double(nodes) : 0.0);
+        out << buf;
+    }
+}
+
+// Overlay (F3) with a frame time graph, the frame counters and phase
+// timings. Frame times go into a ring buffer; the text is rebuilt only a
+// few times a second and drawn as a single sf::Text. It runs on the render
+// thread, so its font must be one no other thread uses.
+class PerfHud {
+public:
+    explicit PerfHud(const sf::Font& font) : graph(sf::LineStrip, history) {
+        text.setFont(font);
+        text.setCharacterSize(14);
+        text.setFillColor(sf::Color::White);
+        background.setFillColor(sf::Color(0, 0, 0, 180));
+    }
+
+    void addFrame(float frameMs, float cpuMs, const FrameStats& stats) {
+        times[next] = frameMs;
+        next = (next + 1) % history;
+        lastCpuMs = cpuMs;
+        last = stats;
+    }
+
+    void draw(sf::RenderTarget& target, std::uint64_t totalNodes, std::size_t treeBytes) {
+        const float width = float(history), graphHeight = 60.f, margin = 10.f;
+        const float top = target.getSize().y - margin - 200.f;
+
+        if (refresh.getElapsedTime().asMilliseconds() >= 250) {
+            refresh.restart();
+            float worst = 0.f, sum = 0.f;
+            for (float ms : times) {
+                worst = std::max(worst, ms);
+                sum += ms;
+            }
+            char buf[128];
+            std::string str;
+            std::snprintf(buf, sizeof(buf), "frame %.2f ms avg, %.2f ms max, cpu %.2f ms\n",
+                          sum / history, worst, lastCpuMs);
+            str += buf;
+            for (int c = 0; c < CounterCount; ++c) {
+                std::snprintf(buf, sizeof(buf), "%s: %llu\n", counterNames[c],
+                              (unsigned long long)last.counts[c]);
+                str += buf;
+            }
+            std::snprintf(buf, sizeof(buf), "total nodes: %llu\ntree memory: ",
+                          (unsigned long long)totalNodes);
+            str += buf + formatBytes(treeBytes) + "\n";
+            std::lock_guard<std::mutex> lock(phaseMutex);
+            for (auto& phase : phaseTimes) {
+                std::snprintf(buf, sizeof(buf), "%s: %.1f ms\n", phase.first, phase.second);
+                str += buf;
+            }
+            text.setString(str);
+        }
+
+        // Graph scaled so 33 ms (30 fps) is the top edge
+        for (std::size_t i = 0; i < history; ++i) {
+            float ms = times[(next + i) % history];
+            graph[i].position = { margin + float(i),
+                                  top + graphHeight - std::min(ms / 33.f, 1.f) * graphHeight };
+            graph[i].color = ms > 17.f ? sf::Color(255, 80, 80) : sf::Color(80, 255, 80);
+        }
+
+        sf::FloatRect bounds = text.getLocalBounds();
+        background.setPosition(margin / 2.f, top - margin / 2.f);
+        background.setSize({ std::max(width, bounds.width) + margin,
+                             graphHeight + bounds.height + 2 * margin });
+        text.setPosition(margin, top + graphHeight + margin / 2.f);
+
+        target.setView(target.getDefaultView());
+        target.draw(background);
+        target.draw(graph);
+        target.draw(text);
+    }
+
+private:
+    static const std::size_t history = 240;
+    std::array<float, history> times{};
+    std::size_t next = 0;
+    float lastCpuMs = 0.f;
+    FrameStats last;
+    sf::Text text;
+    sf::VertexArray graph;
+    sf::RectangleShape background;
+    sf::Clock refresh;
+};
+
+// ---- Duplicate files ----
+// Files with identical contents, found in three narrowing passes so that
+// most files are never opened: only sizes shared by several files are read
+// at all, and of those only the first and last DUP_BLOCK bytes unless that
+// still leaves several candidates.
+
+// 128-bit non-cryptographic hash of a byte stream, two 64-bit lanes of
+// multiply-rotate mixing over 16-byte blocks
+class ContentHash {
+public:
+    typedef std::pair<std::uint64_t, std::uint64_t> Digest;
+
+    void update(const unsigned char* data, std::size_t n) {
+        m_length += n;
+        if (m_tailLength) {
+            std::size_t take = std::min(n, sizeof(m_tail) - m_tailLength);
+            std::memcpy(m_tail + m_tailLength, data, take);
+            m_tailLength += take;
+            data += take;
+            n -= take;
+            if (m_tailLength < sizeof(m_tail))
+                return;
+            block(m_tail);
+            m_tailLength = 0;
+        }
+        for (; n >= 16; data += 16, n -= 16)
+            block(data);
+        std::memcpy(m_tail, data, n);
+        m_tailLength = n;
+    }
+
+    Digest finish() const {
+        ContentHash h = *this;
+        if (h.m_tailLength) {
+            std::memset(h.m_tail + h.m_tailLength, 0, sizeof(h.m_tail) - h.m_tailLength);
+            h.block(h.m_tail);
+        }
+        std::uint64_t a = fmix(h.m_a ^ m_length), b = fmix(h.m_b ^ m_length);
+        return Digest(a + b, a + 2 * b);
+    }
+
+private:
+    static std::uint64_t rotl(std::uint64_t v, int r) { return (v << r) | (v >> (64 - r)); }
+    static std::uint64_t fmix(std::uint64_t v) {
+        v ^= v >> 33; v *= 0xFF51AFD7ED558CCDull;
+        v ^= v >> 33; v *= 0xC4CEB9FE1A85EC53ull;
+        return v ^ (v >> 33);
+    }
+    void block(const unsigned char* data) {
+        std::uint64_t k1, k2;
+        std::memcpy(&k1, data, 8);
+        std::memcpy(&k2, data + 8, 8);
+        m_a ^= rotl(k1 * 0x87C37B91114253D5ull, 31) * 0x4CF5AD432745937Full;
+        m_a = rotl(m_a, 27) + m_b;
+        m_a = m_a * 5 + 0x52DCE729;
+        m_b ^= rotl(k2 * 0x4CF5AD432745937Full, 33) * 0x87C37B91114253D5ull;
+        m_b = rotl(m_b, 31) + m_a;
+        m_b = m_b * 5 + 0x38495AB5;
+    }
+
+    std::uint64_t m_a = 0x9E3779B97F4A7C15ull, m_b = 0xC2B2AE3D27D4EB4Full;
+    std::uint64_t m_length = 0;
+    unsigned char m_tail[16];
+    std::size_t m_tailLength = 0;
+};
+
+// Caps how many threads are reading files at the same time, so hashing
+// threads do not turn into one random-access storm on a single disk
+class IoGate {
+public:
+    explicit IoGate(unsigned limit) : m_free(std::max(1u, limit)) {}
+    void acquire() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_wake.wait(lock, [&] { return m_free > 0; });
+        --m_free;
+    }
+    void release() {
+        { std::lock_guard<std::mutex> lock(m_mutex); ++m_free; }
+        m_wake.notify_one();
+    }
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    unsigned m_free;
+};
+
+// Disk path of a node in a tree scanned from rootPath
+fs::path nodePath(const fs::path& rootPath, const FileNode& node) {
+    std::vector<const FileNode*> chain;
+    for (const FileNode* n = &node; n->parent; n = n->parent)
+        chain.push_back(n);
+    fs::path path = rootPath;
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+        path /= (*it)->name.c_str();
+    return path;
+}
+
+// Hash a file of the given size: all of it, or with partial just its first
+// and last DUP_BLOCK bytes. Whole files are mapped rather than copied
+// through a buffer. False if the file cannot be read or no longer has that
+// size.
+bool hashFile(const fs::path& path, std::uintmax_t size, bool partial,
+              ContentHash::Digest& out, std::uint64_t& bytesRead) {
+    ContentHash hash;
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && std::uintmax_t(st.st_size) == size;
+    if (ok && partial) {
+        unsigned char buffer[DUP_BLOCK];
+        for (std::uintmax_t offset : { std::uintmax_t(0), size - DUP_BLOCK }) {
+            ok = ok && pread(fd, buffer, DUP_BLOCK, off_t(offset)) == DUP_BLOCK;
+            hash.update(buffer, DUP_BLOCK);
+        }
+        bytesRead += 2 * DUP_BLOCK;
+    } else if (ok && size > 0) {
+        void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ok = data != MAP_FAILED;
+        if (ok) {
+            madvise(data, size, MADV_SEQUENTIAL);
+            hash.update(static_cast<const unsigned char*>(data), size);
+            munmap(data, size);
+            bytesRead += size;
+        }
+    }
+    ::close(fd);
+    if (!ok)
+        return false;
+#else
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    std::vector<char> buffer(partial ? DUP_BLOCK : std::size_t(1) << 20);
+    auto read = [&](std::uintmax_t count) {
+        while (count > 0 && file) {
+            std::size_t n = std::size_t(std::min<std::uintmax_t>(count, buffer.size()));
+            file.read(buffer.data(), n);
+            hash.update(reinterpret_cast<const unsigned char*>(buffer.data()), std::size_t(file.gcount()));
+            bytesRead += std::uint64_t(file.gcount());
+            count -= n;
+        }
+        return bool(file);
+    };
+    if (partial) {
+        if (!read(DUP_BLOCK) || !file.seekg(std::streamoff(size - DUP_BLOCK)) || !read(DUP_BLOCK))
+            return false;
+    } else if (!read(size) || file.peek() != std::ifstream::traits_type::eof()) {
+        return false;
+    }
+#endif
+    out = hash.finish();
+    return true;
+}
+
+struct DuplicateSet {
+    std::uintmax_t size = 0;        // of each copy
+    std::vector<FileNode*> files;
+};
+
+struct DuplicateReport {
+    std::vector<DuplicateSet> sets; // most reclaimable space first
+    std::uint64_t files = 0;        // regular files looked at
+    std::uint64_t partialHashed = 0;
+    std::uint64_t fullHashed = 0;
+    std::uint64_t bytesRead = 0;
+    std::uintmax_t reclaimable = 0; // bytes freed by keeping one copy of each set
+};
+
+// Find duplicate files in a tree scanned from rootPath and number each
+// node's set in duplicateSet. Hashing runs on a pool of hardware threads,
+// at most ioLimit of them reading at a time.
+DuplicateReport findDuplicates(FileNode& root, const fs::path& rootPath, unsigned ioLimit) {
+    TRACE_ZONE("findDuplicates");
+    DuplicateReport report;
+    const unsigned workers = std::max(1u, std::thread::hardware_concurrency());
+    IoGate gate(ioLimit);
+
+    // Sizes first: only empty-free, not yet counted hard links are real copies
+    struct Candidate {
+        FileNode* node;
+        ContentHash::Digest digest;
+        bool complete = false;          // digest covers the whole file
+        bool readable = true;
+    };
+    std::vector<Candidate> candidates;
+    walkPreorder(root, [&](FileNode& node, int) {
+        node.duplicateSet = 0;
+        if (node.type == NodeType::File && !node.hardLinkSeen && node.size > 0) {
+            ++report.files;
+            candidates.push_back({ &node, {} });
+        }
+        return true;
+    });
+
+    // Keep runs of two or more equal keys, dropping everything else
+    auto keepGroups = [&](auto key) {
+        std::sort(candidates.begin(), candidates.end(),
+                  [&](const Candidate& a, const Candidate& b) { return key(a) < key(b); });
+        std::size_t kept = 0;
+        for (std::size_t i = 0, j; i < candidates.size(); i = j) {
+            for (j = i + 1; j < candidates.size() && key(candidates[j]) == key(candidates[i]); ++j) {}
+            if (j - i > 1 && candidates[i].readable)
+                for (std::size_t k = i; k < j; ++k)
+                    candidates[kept++] = candidates[k];
+        }
+        candidates.resize(kept);
+    };
+    auto hashAll = [&](bool partial, std::uint64_t& hashed) {
+        std::vector<std::size_t> todo;
+        for (std::size_t i = 0; i < candidates.size(); ++i)
+            if (!candidates[i].complete)
+                todo.push_back(i);
+        std::atomic<std::uint64_t> bytes{ 0 };
+        parallelFor(todo.size(), workers, [&](std::size_t t) {
+            Candidate& c = candidates[todo[t]];
+            // Small files are read whole right away
+            bool whole = !partial || c.node->size <= 2 * DUP_BLOCK;
+            fs::path path = nodePath(rootPath, *c.node);
+            std::uint64_t read = 0;
+            {
+                TRACE_ZONE("io wait");
+                gate.acquire();
+            }
+            {
+                TRACE_ZONE("hash file");
+                c.readable = hashFile(path, c.node->size, !whole, c.digest, read);
+            }
+            gate.release();
+            c.complete = whole;
+            bytes += read;
+        });
+        hashed += todo.size();
+        report.bytesRead += bytes;
+    };
+    auto bySize = [](const Candidate& c) { return std::make_tuple(c.node->size, true); };
+    auto byDigest = [](const Candidate& c) { return std::make_tuple(c.node->size, c.readable, c.digest); };
+
+    keepGroups(bySize);
+    hashAll(true, report.partialHashed);
+    keepGroups(byDigest);
+    hashAll(false, report.fullHashed);
+    keepGroups(byDigest);
+
+    for (std::size_t i = 0, j; i < candidates.size(); i = j) {
+        DuplicateSet set;
+        set.size = candidates[i].node->size;
+        for (j = i; j < candidates.size() && byDigest(candidates[j]) == byDigest(candidates[i]); ++j)
+            set.files.push_back(candidates[j].node);
+        report.reclaimable += set.size * (set.files.size() - 1);
+        report.sets.push_back(std::move(set));
+    }
+    std::sort(report.sets.begin(), report.sets.end(), [](const DuplicateSet& a, const DuplicateSet& b) {
+        return a.size * (a.files.size() - 1) > b.size * (b.files.size() - 1);
+    });
+    for (std::size_t i = 0; i < report.sets.size(); ++i)
+        for (FileNode* node : report.sets[i].files)
+            node->duplicateSet = std::uint32_t(i + 1);
+    return report;
+}
+
+void printDuplicateReport(std::ostream& out, const DuplicateReport& report,
+                          const fs::path& rootPath, std::size_t maxSets) {
+    std::uint64_t copies = 0;
+    for (auto& set : report.sets)
+        copies += set.files.size();
+    out << "Duplicates: " << report.sets.size() << " sets, " << copies << " files, "
+        << formatBytes(report.reclaimable) << " reclaimable\n"
+        << "  " << report.files << " files, " << report.partialHashed << " partially and "
+        << report.fullHashed << " fully hashed, " << formatBytes(report.bytesRead) << " read\n";
+    for (std::size_t i = 0; i < report.sets.size() && i < maxSets; ++i) {
+        const DuplicateSet& set = report.sets[i];
+        out << "  " << set.files.size() << " x " << formatBytes(set.size) << '\n';
+        for (FileNode* node : set.files)
+            out << "    " << nodePath(rootPath, *node).string() << '\n';
+    }
+}
+
+// ---- Snapshots ----
+// --save FILE writes a scan to disk so later runs can compare against it.
+// The format is a header followed by one record per node in pre-order,
+// children sorted by name:
+//   type byte (NodeType, bit 7 set if the node is a repeated hard link)
+//   name length, name bytes
+//   size, allocated, zigzag mtime, child count
+// with every number stored as a LEB128 varint.
+
+const char snapshotMagic[8] = { 'F', 'T', 'S', 'N', 'A', 'P', '1', '\n' };
+
+// Append v to a byte string as a LEB128 varint
+void putVarint(std::string& out, std::uint64_t v) {
+    for (; v >= 0x80; v >>= 7)
+        out.push_back(char(v | 0x80));
+    out.push_back(char(v));
+}
+
+// Read a varint from [pos, end); false if it runs past the end
+bool getVarint(const char*& pos, const char* end, std::uint64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 64 && pos < end; shift += 7) {
+        std::uint8_t b = std::uint8_t(*pos++);
+        v |= std::uint64_t(b & 0x7F) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+inline std::uint64_t zigzag(std::int64_t v) { return (std::uint64_t(v) << 1) ^ std::uint64_t(v >> 63); }
+inline std::int64_t unzigzag(std::uint64_t v) { return std::int64_t(v >> 1) ^ -std::int64_t(v & 1); }
+
+// Buffered varint writer
+class SnapshotWriter {
+public:
+    explicit SnapshotWriter(std::ostream& out) : m_out(out) { m_buffer.reserve(bufferSize + 64); }
+    ~SnapshotWriter() { flush(); }
+
+    void byte(std::uint8_t b) { m_buffer.push_back(char(b)); }
+    void varint(std::uint64_t v) { putVarint(m_buffer, v); }
+    void bytes(const char* data, std::size_t n) {
+        m_buffer.append(data, n);
+        if (m_buffer.size() >= bufferSize)
+            flush();
+    }
+    void flush() {
+        m_out.write(m_buffer.data(), std::streamsize(m_buffer.size()));
+        m_buffer.clear();
+    }
+
+private:
+    static const std::size_t bufferSize = 1 << 20;
+    std::ostream& m_out;
+    std::string m_buffer;
+};
+
+// Buffered varint reader; once the input runs out every read fails
+class SnapshotReader {
+public:
+    explicit SnapshotReader(std::istream& in) : m_in(in), m_buffer(1 << 20) {}
+
+    bool byte(std::uint8_t& b) {
+        if (m_pos == m_end && !refill())
+            return false;
+        b = std::uint8_t(m_buffer[m_pos++]);
+        return true;
+    }
+    bool varint(std::uint64_t& v) {
+        v = 0;
+        std::uint8_t b;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (!byte(b))
+                return false;
+            v |= std::uint64_t(b & 0x7F) << shift;
+            if (!(b & 0x80))
+                return true;
+        }
+        return false;
+    }
+    bool bytes(char* out, std::size_t n) {
+        while (n > 0) {
+            if (m_pos == m_end && !refill())
+                return false;
+            std::size_t take = std::min(n, m_end - m_pos);
+            std::memcpy(out, m_buffer.data() + m_pos, take);
+            m_pos += take;
+            out += take;
+            n -= take;
+        }
+        return true;
+    }
+
+private:
+    bool refill() {
+        m_in.read(m_buffer.data(), std::streamsize(m_buffer.size()));
+        m_pos = 0;
+        m_end = std::size_t(m_in.gcount());
+        return m_end > 0;
+    }
+
+    std::istream& m_in;
+    std::vector<char> m_buffer;
+    std::size_t m_pos = 0, m_end = 0;
+};
+
+bool saveSnapshot(const FileNode& root, const std::string& path) {
+    TRACE_ZONE("saveSnapshot");
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    file.write(snapshotMagic, sizeof(snapshotMagic));
+    {
+        SnapshotWriter out(file);
+        std::vector<const FileNode*> children;
+        std::vector<const FileNode*> stack(1, &root);
+        while (!stack.empty()) {
+            const FileNode& node = *stack.back();
+            stack.pop_back();
+            out.byte(std::uint8_t(node.type) | (node.hardLinkSeen ? 0x80 : 0));
+            out.varint(node.name.size());
+            out.bytes(node.name.data(), node.name.size());
+            out.varint(node.size);
+            out.varint(node.allocated);
+            out.varint(zigzag(node.mtime));
+            out.varint(node.children.size());
+            children.clear();
+            for (auto& c : node.children)
+                children.push_back(c.get());
+            std::sort(children.begin(), children.end(),
+                      [](const FileNode* a, const FileNode* b) { return a->name < b->name; });
+            stack.insert(stack.end(), children.rbegin(), children.rend());
+        }
+    }
+    return bool(file);
+}
+
+// Read a snapshot back into a tree; null if the file is missing, not a
+// snapshot or cut short. Leaf counts and hashes still need computeLeafs.
+std::shared_ptr<FileNode> loadSnapshot(const std::string& path) {
+    TRACE_ZONE("loadSnapshot");
+    std::ifstream file(path, std::ios::binary);
+    char magic[sizeof(snapshotMagic)];
+    if (!file.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), snapshotMagic))
+        return nullptr;
+    SnapshotReader in(file);
+
+    auto readNode = [&](FileNode& node, std::uint64_t& childCount) {
+        std::uint8_t type;
+        std::uint64_t nameLength, size, allocated, mtime;
+        if (!in.byte(type) || (type & 0x7F) > std::uint8_t(NodeType::Other) || !in.varint(nameLength))
+            return false;
+        node.name.resize(std::size_t(nameLength));
+        if (!in.bytes(&node.name[0], node.name.size()) || !in.varint(size) ||
+            !in.varint(allocated) || !in.varint(mtime) || !in.varint(childCount))
+            return false;
+        node.type = NodeType(type & 0x7F);
+        node.hardLinkSeen = (type & 0x80) != 0;
+        node.size = size;
+        node.allocated = allocated;
+        node.mtime = unzigzag(mtime);
+        setExtension(node);
+        return true;
+    };
+
+    auto root = makeNode();
+    std::uint64_t childCount;
+    if (!readNode(*root, childCount))
+        return nullptr;
+    // Each entry holds a directory and how many of its children are still to come
+    std::vector<std::pair<FileNode*, std::uint64_t>> stack;
+    if (childCount)
+        stack.push_back({ root.get(), childCount });
+    while (!stack.empty()) {
+        auto& [parent, remaining] = stack.back();
+        auto child = makeNode();
+        if (!readNode(*child, childCount))
+            return nullptr;
+        child->parent = parent;
+        FileNode* node = child.get();
+        parent->children.push_back(std::move(child));
+        if (--remaining == 0)
+            stack.pop_back();
+        if (childCount) {
+            node->children.reserve(std::size_t(std::min<std::uint64_t>(childCount, 1 << 16)));
+            stack.push_back({ node, childCount });
+        }
+    }
+    return root;
+}
+
+struct DiffSummary {
+    std::uint64_t counts[6] = {};   // changed entries by ChangeKind
+    std::int64_t sizeDelta = 0;     // of the whole tree
+};
+
+// Combine two snapshots of a tree into one tree to view: the newer tree,
+// with every entry that changed marked and every removed entry moved over
+// from the older one. Unchanged directories, and added or removed
+// subtrees, start out collapsed, so only what changed is expanded. Both
+// trees must have been through computeLeafs; before is left unusable.
+DiffSummary diffTrees(FileNode& before, FileNode& after) {
+    TRACE_ZONE("diffTrees");
+    DiffSummary summary;
+    summary.sizeDelta = std::int64_t(after.totalSize) - std::int64_t(before.totalSize);
+
+    // Directories present on both sides, to find where removed entries go
+    std::unordered_map<const FileNode*, FileNode*> counterpart;
+    std::vector<std::pair<FileNode*, FileNode*>> removed;
+    walkChanges(before, after, [&](FileNode* a, FileNode* b, int) {
+        if (!a) {
+            b->change = ChangeKind::Added;
+            b->sizeDelta = std::int64_t(b->totalSize);
+        } else if (!b) {
+            a->change = ChangeKind::Removed;
+            a->sizeDelta = -std::int64_t(a->totalSize);
+            removed.push_back({ a, counterpart[a->parent] });
+        } else {
+            b->sizeDelta = std::int64_t(b->totalSize) - std::int64_t(a->totalSize);
+            b->change = b->sizeDelta > 0 ? ChangeKind::Grown :
+                        b->sizeDelta < 0 ? ChangeKind::Shrunk : ChangeKind::Modified;
+            counterpart[a] = b;
+        }
+        ++summary.counts[int((a && b) ? b->change : a ? ChangeKind::Removed : ChangeKind::Added)];
+        return a && b;
+    });
+
+    // Move removed subtrees into the newer tree, keeping children sorted
+    for (auto [node, parent] : removed) {
+        auto& siblings = node->parent->children;
+        auto it = std::find_if(siblings.begin(), siblings.end(), [&](auto& c) { return c.get() == node; });
+        std::shared_ptr<FileNode> owned = std::move(*it);
+        siblings.erase(it);
+        node->parent = parent;
+        auto at = std::lower_bound(parent->children.begin(), parent->children.end(), node->name,
+                                   [](const std::shared_ptr<FileNode>& c, const NameString& name) {
+                                       return c->name < name;
+                                   });
+        parent->children.insert(at, std::move(owned));
+    }
+
+    walkPreorder(after, [](FileNode& node, int) {
+        bool changed = node.change != ChangeKind::Same;
+        bool whole = node.change == ChangeKind::Added || node.change == ChangeKind::Removed;
+        node.collapsed = !node.children.empty() && (!changed || whole);
+        if (whole)
+            walkPreorder(node, [&](FileNode& n, int) { n.change = node.change; return true; });
+        return !node.collapsed;
+    });
+    return summary;
+}
+
+void printDiffSummary(std::ostream& out, const DiffSummary& summary) {
+    const char* names[] = { "unchanged", "added", "removed", "grown", "shrunk", "modified" };
+    out << "Diff: " << (summary.sizeDelta < 0 ? "-" : "+")
+        << formatBytes(std::uintmax_t(std::abs(summary.sizeDelta)));
+    for (int k = 1; k < 6; ++k)
+        out << ", " << summary.counts[k] << ' ' << names[k];
+    out << '\n';
+}
+
+// ---- Snapshot store ----
+// --store FILE appends every scan to one history file rather than keeping
+// full snapshots: every STORE_KEYFRAME-th version is a complete base, the
+// rest only hold what was added, removed or changed since the version
+// before. Entries are keyed by a hash of their path, so an entry has the
+// same identity in every version.
+//
+// A version is a header (kind byte, then time and payload length as 8-byte
+// little-endian numbers) followed by blocks of up to STORE_BLOCK records
+// and an empty block. A block stores its records column by column, each
+// column encoded to suit it: names front-coded against the previous name,
+// mtimes as deltas, allocated bytes relative to size, and parents as the
+// number of steps up from the previous record, with an explicit identity
+// only when the parent is not an ancestor of it.
+
+const char storeMagic[8] = { 'F', 'T', 'S', 'T', 'O', 'R', 'E', '\n' };
+const std::uint64_t storeRootId = 1;
+
+// Record flags above the NodeType in the low bits
+enum : std::uint8_t { StoreRemoved = 0x40, StoreHardLink = 0x80, StoreTypeMask = 0x0F };
+
+// Identity of an entry from its parent's identity and its name
+std::uint64_t storeIdentity(std::uint64_t parentId, std::string_view name) {
+    return mix64(nameHash(name) ^ (parentId * 0x9E3779B97F4A7C15ull));
+}
+
+// Identity of a node, from the names on its path
+std::uint64_t storeIdentity(const FileNode& node) {
+    std::vector<const FileNode*> path;
+    for (const FileNode* n = &node; n->parent; n = n->parent)
+        path.push_back(n);
+    std::uint64_t id = storeRootId;
+    for (auto it = path.rbegin(); it != path.rend(); ++it)
+        id = storeIdentity(id, std::string_view((*it)->name.data(), (*it)->name.size()));
+    return id;
+}
+
+// One entry of a version as read back
+struct StoreRecord {
+    std::uint8_t flags = 0;
+    std::uint64_t parentSteps = 0;  // k + 1: k-th ancestor of the previous record; 0: parentId
+    std::uint64_t parentId = 0;     // 0 for the root
+    std::string name;
+    std::uintmax_t size = 0, allocated = 0;
+    std::int64_t mtime = 0;
+};
+
+enum StoreColumn { ColFlags, ColParents, ColNames, ColSizes, ColAllocated, ColMtimes, ColCount };
+
+// Encodes one version's records into column blocks
+class StoreVersionWriter {
+public:
+    explicit StoreVersionWriter(SnapshotWriter& out) : m_out(out) {}
+
+    // Add or update a node, as it is in the tree being stored
+    void upsert(const FileNode& node) {
+        add(std::uint8_t(node.type) | (node.hardLinkSeen ? StoreHardLink : 0), node.parent, node.name, &node);
+        m_prev = &node;
+    }
+
+    // Remove the child of parent with the given name
+    void remove(const FileNode& parent, const NameString& name) {
+        add(StoreRemoved, &parent, name, nullptr);
+        m_prev = &parent;
+    }
+
+    // Write the last block and the empty block that ends the version
+    void finish() {
+        flush();
+        m_out.varint(0);
+    }
+
+private:
+    void add(std::uint8_t flags, const FileNode* parent, const NameString& name, const FileNode* node) {
+        m_columns[ColFlags].push_back(char(flags));
+        std::uint64_t steps = 0;
+        if (parent) {
+            std::uint64_t k = 1;
+            for (const FileNode* p = m_prev; p; p = p->parent, ++k)
+                if (p == parent) {
+                    steps = k;
+                    break;
+                }
+        }
+        putVarint(m_columns[ColParents], steps);
+        if (!steps)
+            putVarint(m_columns[ColParents], parent ? storeIdentity(*parent) : 0);
+
+        std::string& names = m_columns[ColNames];
+        std::size_t shared = 0;
+        while (shared < name.size() && shared < m_lastName.size() && name[shared] == m_lastName[shared])
+            ++shared;
+        putVarint(names, shared);
+        putVarint(names, name.size() - shared);
+        names.append(name.data() + shared, name.size() - shared);
+        m_lastName.assign(name.data(), name.size());
+
+        if (node) {
+            putVarint(m_columns[ColSizes], node->size);
+            putVarint(m_columns[ColAllocated], zigzag(std::int64_t(node->allocated - node->size)));
+            putVarint(m_columns[ColMtimes], zigzag(node->mtime - m_lastMtime));
+            m_lastMtime = node->mtime;
+        }
+        if (++m_count == STORE_BLOCK)
+            flush();
+    }
+
+    void flush() {
+        if (!m_count)
+            return;
+        m_out.varint(m_count);
+        for (auto& column : m_columns)
+            m_out.varint(column.size());
+        for (auto& column : m_columns) {
+            m_out.bytes(column.data(), column.size());
+            column.clear();
+        }
+        m_count = 0;
+        m_lastName.clear();
+        m_lastMtime = 0;
+    }
+
+    SnapshotWriter& m_out;
+    std::string m_columns[ColCount];
+    std::size_t m_count = 0;
+    std::string m_lastName;
+    std::int64_t m_lastMtime = 0;
+    const FileNode* m_prev = nullptr;
+};
+
+// Decodes one version's records, a block at a time
+class StoreVersionReader {
+public:
+    explicit StoreVersionReader(SnapshotReader& in) : m_in(in) {}
+
+    // False at the end of the version or on a damaged block; see failed()
+    bool next(StoreRecord& r) {
+        if (m_left == 0 && !readBlock())
+            return false;
+        --m_left;
+        auto fail = [&] { m_failed = true; return false; };
+        const char*& flags = m_pos[ColFlags];
+        if (flags == m_end[ColFlags])
+            return fail();
+        r.flags = std::uint8_t(*flags++);
+        if (!getVarint(m_pos[ColParents], m_end[ColParents], r.parentSteps) ||
+            (!r.parentSteps && !getVarint(m_pos[ColParents], m_end[ColParents], r.parentId)))
+            return fail();
+        if (r.parentSteps)
+            r.parentId = 0;
+        std::uint64_t shared, added;
+        const char*& names = m_pos[ColNames];
+        if (!getVarint(names, m_end[ColNames], shared) || !getVarint(names, m_end[ColNames], added) ||
+            shared > m_lastName.size() || added > std::uint64_t(m_end[ColNames] - names))
+            return fail();
+        m_lastName.resize(std::size_t(shared));
+        m_lastName.append(names, std::size_t(added));
+        names += added;
+        r.name = m_lastName;
+        if (!(r.flags & StoreRemoved)) {
+            std::uint64_t size, slack, mtime;
+            if (!getVarint(m_pos[ColSizes], m_end[ColSizes], size) ||
+                !getVarint(m_pos[ColAllocated], m_end[ColAllocated], slack) ||
+                !getVarint(m_pos[ColMtimes], m_end[ColMtimes], mtime))
+                return fail();
+            r.size = size;
+            r.allocated = std::uintmax_t(std::int64_t(size) + unzigzag(slack));
+            m_lastMtime += unzigzag(mtime);
+            r.mtime = m_lastMtime;
+        }
+        return true;
+    }
+
+    bool failed() const { return m_failed; }
+
+private:
+    bool readBlock() {
+        std::uint64_t count, lengths[ColCount], total = 0;
+        if (!m_in.varint(count)) {
+            m_failed = true;
+            return false;
+        }
+        if (count == 0)
+            return false;
+        for (auto& length : lengths) {
+            if (!m_in.varint(length) || length > (std::uint64_t(1) << 32)) {
+                m_failed = true;
+                return false;
+            }
+            total += length;
+        }
+        m_block.resize(std::size_t(total));
+        if (!m_in.bytes(m_block.data(), m_block.size())) {
+            m_failed = true;
+            return false;
+        }
+        const char* p = m_block.data();
+        for (int c = 0; c < ColCount; ++c) {
+            m_pos[c] = p;
+            m_end[c] = p += lengths[c];
+        }
+        m_left = count;
+        m_lastName.clear();
+        m_lastMtime = 0;
+        return true;
+    }
+
+    SnapshotReader& m_in;
+    std::vector<char> m_block;
+    const char* m_pos[ColCount] = {};
+    const char* m_end[ColCount] = {};
+    std::uint64_t m_left = 0;
+    std::string m_lastName;
+    std::int64_t m_lastMtime = 0;
+    bool m_failed = false;
+};
+
+// A tree rebuilt from a store, with what is needed to apply further
+// versions to it: the version it holds and its directories by identity.
+// Children are kept sorted by name.
+struct StoreTree {
+    std::shared_ptr<FileNode> root;
+    std::size_t version = 0;
+    std::unordered_map<std::uint64_t, FileNode*> dirs;
+    std::unordered_map<const FileNode*, std::uint64_t> ids;
+
+    // Apply one record; false if it refers to a directory that is not there
+    bool apply(const StoreRecord& r) {
+        FileNode* parent = nullptr;
+        if (r.parentSteps) {
+            parent = m_prev;
+            for (std::uint64_t k = 1; k < r.parentSteps && parent; ++k)
+                parent = parent->parent;
+            if (!parent)
+                return false;
+        } else if (r.parentId) {
+            auto found = dirs.find(r.parentId);
+            if (found == dirs.end())
+                return false;
+            parent = found->second;
+        }
+
+        if (!parent) {
+            if (r.flags & StoreRemoved)
+                return false;
+            if (!root) {
+                root = makeNode();
+                enter(*root, storeRootId);
+            }
+            setMetadata(*root, r);
+            m_prev = root.get();
+            return true;
+        }
+
+        auto& children = parent->children;
+        auto it = std::lower_bound(children.begin(), children.end(), r.name,
+                                   [](const std::shared_ptr<FileNode>& c, const std::string& name) {
+                                       return std::string_view(c->name.data(), c->name.size()) < name;
+                                   });
+        bool found = it != children.end() &&
+                     std::string_view((*it)->name.data(), (*it)->name.size()) == r.name;
+        if (r.flags & StoreRemoved) {
+            if (found) {
+                forget(**it);
+                children.erase(it);
+            }
+            m_prev = parent;
+            return true;
+        }
+        FileNode* node;
+        if (found) {
+            node = it->get();
+        } else {
+            auto child = makeNode();
+            child->parent = parent;
+            child->name.assign(r.name.data(), r.name.size());
+            node = child.get();
+            children.insert(it, std::move(child));
+        }
+        bool wasDirectory = found && node->type == NodeType::Directory;
+        setMetadata(*node, r);
+        if (wasDirectory && node->type != NodeType::Directory) {
+            forget(*node);
+            node->children.clear();
+        } else if (!wasDirectory && node->type == NodeType::Directory) {
+            enter(*node, storeIdentity(ids[parent], r.name));
+        }
+        m_prev = node;
+        return true;
+    }
+
+private:
+    static void setMetadata(FileNode& node, const StoreRecord& r) {
+        node.name.assign(r.name.data(), r.name.size());
+        node.type = NodeType(r.flags & StoreTypeMask);
+        node.hardLinkSeen = (r.flags & StoreHardLink) != 0;
+        node.size = r.size;
+        node.allocated = r.allocated;
+        node.mtime = r.mtime;
+        setExtension(node);
+    }
+
+    void enter(FileNode& dir, std::uint64_t id) {
+        dirs[id] = &dir;
+        ids[&dir] = id;
+    }
+
+    // Drop the directories of a subtree from the index
+    void forget(FileNode& node) {
+        walkPreorder(node, [&](FileNode& n, int) {
+            auto id = ids.find(&n);
+            if (id != ids.end()) {
+                dirs.erase(id->second);
+                ids.erase(id);
+            }
+            return true;
+        });
+    }
+
+    FileNode* m_prev = nullptr;
+};
+
+class SnapshotStore {
+public:
+    explicit SnapshotStore(std::string path) : m_path(std::move(path)) {}
+
+    // Read the version index. A missing file is an empty store; a version
+    // cut short by an interrupted append is ignored and overwritten by the
+    // next one.
+    bool open() {
+        m_versions.clear();
+        m_times.clear();
+        m_end = 0;
+        std::ifstream file(m_path, std::ios::binary);
+        if (!file)
+            return true;
+        char magic[sizeof(storeMagic)];
+        if (!file.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), storeMagic))
+            return false;
+        file.seekg(0, std::ios::end);
+        const std::uint64_t fileSize = std::uint64_t(file.tellg());
+        m_end = sizeof(storeMagic);
+        unsigned char header[17];
+        while (file.seekg(std::streamoff(m_end)) && file.read(reinterpret_cast<char*>(header), sizeof(header))) {
+            Version v;
+            v.base = header[0] != 0;
+            v.time = std::int64_t(readFixed64(header + 1));
+            v.length = readFixed64(header + 9);
+            v.offset = m_end + sizeof(header);
+            if (v.offset + v.length > fileSize || (m_versions.empty() && !v.base))
+                break;
+            m_versions.push_back(v);
+            m_times.push_back(v.time);
+            m_end = v.offset + v.length;
+        }
+        return true;
+    }
+
+    std::size_t versions() const { return m_versions.size(); }
+    const std::vector<std::int64_t>& times() const { return m_times; }
+
+    // Add a scanned tree, which has been through computeLeafs, as the next
+    // version: a base every STORE_KEYFRAME versions, a delta otherwise
+    bool append(const FileNode& root, std::int64_t time, std::uint64_t& bytes) {
+        TRACE_ZONE("storeAppend");
+        const bool base = m_versions.size() % STORE_KEYFRAME == 0;
+        StoreTree previous;
+        if (!base && !load(m_versions.size() - 1, previous))
+            return false;
+
+        if (m_end == 0) {
+            std::ofstream create(m_path, std::ios::binary | std::ios::trunc);
+            if (!create.write(storeMagic, sizeof(storeMagic)))
+                return false;
+            m_end = sizeof(storeMagic);
+        } else {
+            // Cut off whatever an interrupted append left behind
+            std::error_code ec;
+            fs::resize_file(m_path, m_end, ec);
+            if (ec)
+                return false;
+        }
+        std::fstream file(m_path, std::ios::binary | std::ios::in | std::ios::out);
+        if (!file || !file.seekp(std::streamoff(m_end)))
+            return false;
+        unsigned char header[17] = { std::uint8_t(base) };
+        writeFixed64(header + 1, std::uint64_t(time));
+        file.write(reinterpret_cast<const char*>(header), sizeof(header));
+        {
+            SnapshotWriter out(file);
+            StoreVersionWriter records(out);
+            if (base)
+                writeBase(records, root);
+            else
+                writeDelta(records, *previous.root, root);
+            records.finish();
+        }
+        Version v;
+        v.base = base;
+        v.time = time;
+        v.offset = m_end + sizeof(header);
+        v.length = std::uint64_t(file.tellp()) - v.offset;
+        writeFixed64(header + 9, v.length);
+        file.seekp(std::streamoff(m_end));
+        file.write(reinterpret_cast<const char*>(header), sizeof(header));
+        if (!file.flush())
+            return false;
+        m_versions.push_back(v);
+        m_times.push_back(time);
+        m_end = v.offset + v.length;
+        bytes = sizeof(header) + v.length;
+        return true;
+    }
+
+    // Rebuild a version into tree, with leaf counts and hashes computed. A
+    // tree holding an earlier version is brought forward in place when no
+    // base lies between the two; otherwise it is rebuilt from the nearest
+    // base at or before the version.
+    bool load(std::size_t version, StoreTree& tree) {
+        TRACE_ZONE("storeLoad");
+        if (version >= m_versions.size())
+            return false;
+        std::size_t first = version;
+        while (!m_versions[first].base)
+            --first;
+        if (tree.root && tree.version < version && tree.version >= first)
+            first = tree.version + 1;
+        else
+            tree = StoreTree();
+
+        std::ifstream file(m_path, std::ios::binary);
+        for (std::size_t v = first; v <= version; ++v) {
+            if (!file.seekg(std::streamoff(m_versions[v].offset))) {
+                tree = StoreTree();
+                return false;
+            }
+            SnapshotReader in(file);
+            StoreVersionReader records(in);
+            StoreRecord r;
+            bool ok = true;
+            while (ok && records.next(r))
+                ok = tree.apply(r);
+            if (!ok || records.failed() || !tree.root) {
+                tree = StoreTree();
+                return false;
+            }
+            file.clear();
+        }
+        tree.version = version;
+        computeLeafs(*tree.root);
+        return true;
+    }
+
+private:
+    struct Version {
+        bool base = false;
+        std::int64_t time = 0;
+        std::uint64_t offset = 0, length = 0;
+    };
+
+    static std::uint64_t readFixed64(const unsigned char* p) {
+        std::uint64_t v = 0;
+        for (int i = 7; i >= 0; --i)
+            v = (v << 8) | p[i];
+        return v;
+    }
+    static void writeFixed64(unsigned char* p, std::uint64_t v) {
+        for (int i = 0; i < 8; ++i, v >>= 8)
+            p[i] = std::uint8_t(v);
+    }
+
+    // Every node, in pre-order with children sorted by name
+    static void writeBase(StoreVersionWriter& records, const FileNode& root) {
+        std::vector<const FileNode*> children;
+        std::vector<const FileNode*> stack(1, &root);
+        while (!stack.empty()) {
+            const FileNode& node = *stack.back();
+            stack.pop_back();
+            records.upsert(node);
+            children.clear();
+            for (auto& c : node.children)
+                children.push_back(c.get());
+            std::sort(children.begin(), children.end(),
+                      [](const FileNode* a, const FileNode* b) { return a->name < b->name; });
+            stack.insert(stack.end(), children.rbegin(), children.rend());
+        }
+    }
+
+    // Only the entries whose metadata differs between the trees, found by
+    // descending where subtree hashes differ
+    static void writeDelta(StoreVersionWriter& records, const FileNode& before, const FileNode& after) {
+        auto subtree = [&](const FileNode& node) {
+            walkPreorder(node, [&](const FileNode& n, int) {
+                records.upsert(n);
+                return true;
+            });
+        };
+        std::unordered_map<const FileNode*, const FileNode*> counterpart;
+        walkChanges(before, after, [&](const FileNode* a, const FileNode* b, int) {
+            if (!b) {
+                records.remove(*counterpart[a->parent], a->name);
+                return false;
+            }
+            if (!a || (b->type == NodeType::Directory && a->type != NodeType::Directory)) {
+                subtree(*b);
+                return false;
+            }
+            counterpart[a] = b;
+            if (entryHash(*a) != entryHash(*b))
+                records.upsert(*b);
+            return true;
+        });
+    }
+
+    std::string m_path;
+    std::vector<Version> m_versions;
+    std::vector<std::int64_t> m_times;
+    std::uint64_t m_end = 0;        // end of the last complete version; 0 if there is no file
+};
+
+// ---- ncdu JSON ----
+// --import-ncdu FILE views an export written by `ncdu -o FILE` instead of
+// scanning, and --export-ncdu FILE writes a scan in the same format, for
+// machines where only ncdu can run. An export is
+//   [1, 2, {metadata}, [{root}, {file}, [{dir}, ...], ...]]
+// where a directory is an array headed by its own entry. Both directions
+// stream: the reader pulls tokens from a fixed buffer and keeps only the
+// stack of open directories, so an export of any size loads in the memory
+// of the tree it describes.
+
+// Pull parser for the part of JSON ncdu writes
+class JsonReader {
+public:
+    explicit JsonReader(std::istream& in) : m_in(in), m_buffer(1 << 20) {}
+
+    // Next character after whitespace, without consuming it; -1 at the end
+    int peek() {
+        for (;;) {
+            if (m_pos == m_end && !refill())
+                return -1;
+            char c = m_buffer[m_pos];
+            if (c != ' ' && c != '\n' && c != '\r' && c != '\t')
+                return (unsigned char)c;
+            ++m_pos;
+        }
+    }
+    int get() {
+        int c = peek();
+        if (c >= 0)
+            ++m_pos;
+        return c;
+    }
+    bool expect(char c) { return get() == (unsigned char)c; }
+
+    bool string(std::string& out) {
+        out.clear();
+        if (!expect('"'))
+            return false;
+        for (;;) {
+            if (m_pos == m_end && !refill())
+                return false;
+            // Copy the run up to the next quote or escape in one go
+            const char* begin = m_buffer.data() + m_pos;
+            const char* end = m_buffer.data() + m_end;
+            const char* stop = begin;
+            while (stop != end && *stop != '"' && *stop != '\\')
+                ++stop;
+            out.append(begin, stop);
+            m_pos += std::size_t(stop - begin);
+            if (stop == end)
+                continue;
+            ++m_pos;
+            if (*stop == '"')
+                return true;
+            int e = raw();
+            switch (e) {
+                case '"': case '\\': case '/': out += char(e); break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                    std::uint32_t cp;
+                    if (!hex4(cp))
+                        return false;
+                    if (cp >= 0xD800 && cp < 0xDC00) {
+                        std::uint32_t low;
+                        if (raw() != '\\' || raw() != 'u' || !hex4(low))
+                            return false;
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    appendUtf8(out, cp);
+                    break;
+                }
+                default: return false;
+            }
+        }
+    }
+
+    // An integer; any fraction or exponent is read and dropped
+    bool number(std::int64_t& out) {
+        int c = peek();
+        bool negative = c == '-';
+        if (negative)
+            ++m_pos;
+        std::uint64_t value = 0;
+        int digits = 0;
+        while ((c = raw()) >= '0' && c <= '9') {
+            value = value * 10 + std::uint64_t(c - '0');
+            ++digits;
+        }
+        while (c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-' || (c >= '0' && c <= '9'))
+            c = raw();
+        if (c >= 0)
+            --m_pos;
+        out = negative ? -std::int64_t(value) : std::int64_t(value);
+        return digits > 0;
+    }
+
+    // Skip a value of any kind, nested ones included
+    bool skip() {
+        int depth = 0;
+        do {
+            int c = peek();
+            if (c == '"') {
+                if (!string(m_scratch))
+                    return false;
+            } else if (c == '[' || c == '{') {
+                ++m_pos;
+                ++depth;
+            } else if (c == ']' || c == '}') {
+                ++m_pos;
+                --depth;
+            } else if (c == ',' || c == ':') {
+                ++m_pos;
+            } else if (c == '-' || (c >= '0' && c <= '9')) {
+                std::int64_t n;
+                number(n);
+            } else if (c == 't' || c == 'f' || c == 'n') {
+                while ((c = raw()) >= 'a' && c <= 'z') {}
+                if (c >= 0)
+                    --m_pos;
+            } else {
+                return false;
+            }
+        } while (depth > 0);
+        return true;
+    }
+
+    bool boolean(bool& out) {
+        out = peek() == 't';
+        return skip();
+    }
+
+    // Bytes consumed so far, for error messages
+    std::uint64_t offset() const { return m_consumed + m_pos; }
+
+private:
+    // Next byte as it is, whitespace included
+    int raw() {
+        if (m_pos == m_end && !refill())
+            return -1;
+        return (unsigned char)m_buffer[m_pos++];
+    }
+
+    bool hex4(std::uint32_t& out) {
+        out = 0;
+        for (int i = 0; i < 4; ++i) {
+            int c = raw();
+            int v = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                  : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+            if (v < 0)
+                return false;
+            out = out << 4 | std::uint32_t(v);
+        }
+        return true;
+    }
+
+    static void appendUtf8(std::string& out, std::uint32_t cp) {
+        if (cp < 0x80) {
+            out += char(cp);
+        } else if (cp < 0x800) {
+            out += char(0xC0 | cp >> 6);
+            out += char(0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+            out += char(0xE0 | cp >> 12);
+            out += char(0x80 | (cp >> 6 & 0x3F));
+            out += char(0x80 | (cp & 0x3F));
+        } else {
+            out += char(0xF0 | cp >> 18);
+            out += char(0x80 | (cp >> 12 & 0x3F));
+            out += char(0x80 | (cp >> 6 & 0x3F));
+            out += char(0x80 | (cp & 0x3F));
+        }
+    }
+
+    bool refill() {
+        m_consumed += m_end;
+        m_in.read(m_buffer.data(), std::streamsize(m_buffer.size()));
+        m_pos = 0;
+        m_end = std::size_t(m_in.gcount());
+        return m_end > 0;
+    }
+
+    std::istream& m_in;
+    std::vector<char> m_buffer;
+    std::size_t m_pos = 0, m_end = 0;
+    std::uint64_t m_consumed = 0;
+    std::string m_scratch;
+};
+
+// Read the entry object of a file or directory into a node. dev is the
+// parent's device, replaced if the entry names its own.
+bool readNcduEntry(JsonReader& in, FileNode& node, bool isDir, std::uint64_t& dev,
+                   std::string& key, std::string& name) {
+    if (!in.expect('{'))
+        return false;
+    std::int64_t asize = 0, dsize = 0, devValue = -1, ino = 0, uid = -1, gid = -1;
+    bool hardLink = false, notRegular = false;
+    name.clear();
+    do {
+        if (!in.string(key) || !in.expect(':'))
+            return false;
+        bool ok;
+        if (key == "name")        ok = in.string(name);
+        else if (key == "asize")  ok = in.number(asize);
+        else if (key == "dsize")  ok = in.number(dsize);
+        else if (key == "mtime")  ok = in.number(node.mtime);
+        else if (key == "dev")    ok = in.number(devValue);
+        else if (key == "ino")    ok = in.number(ino);
+        else if (key == "uid")    ok = in.number(uid);
+        else if (key == "gid")    ok = in.number(gid);
+        else if (key == "hlnkc")  ok = in.boolean(hardLink);
+        else if (key == "notreg") ok = in.boolean(notRegular);
+        else                      ok = in.skip();     // nlink, mode, read_error, excluded, ...
+        if (!ok)
+            return false;
+    } while (in.peek() == ',' && in.get() == ',');
+    if (!in.expect('}') || name.empty())
+        return false;
+    if (devValue >= 0)
+        dev = std::uint64_t(devValue);
+    node.name.assign(name.data(), name.size());
+    node.type = isDir ? NodeType::Directory : notRegular ? NodeType::Other : NodeType::File;
+    node.size = std::uintmax_t(std::max<std::int64_t>(asize, 0));
+    node.allocated = std::uintmax_t(std::max<std::int64_t>(dsize, 0));
+    if (hardLink && !isDir)
+        node.hardLinkSeen = !seenInodes.insert({ dev, std::uint64_t(ino) }).second;
+    if (uid >= 0 && gid >= 0) {
+        node.user = users.intern(std::uint32_t(uid));
+        node.group = groups.intern(std::uint32_t(gid));
+    }
+    setExtension(node);
+    return true;
+}
+
+// Load an ncdu export; null with a message in error if it cannot be read.
+// Leaf counts and hashes still need computeLeafs.
+std::shared_ptr<FileNode> readNcdu(std::istream& file, std::string& error) {
+    TRACE_ZONE("readNcdu");
+    JsonReader in(file);
+    seenInodes.clear();
+    std::int64_t major = 0, minor = 0;
+    if (!in.expect('[') || !in.number(major) || !in.expect(',') || !in.number(minor) || major != 1) {
+        error = "not an ncdu export";
+        return nullptr;
+    }
+    // Metadata, if any, then the root directory
+    std::string key, name;
+    bool ok = in.expect(',');
+    if (ok && in.peek() == '{')
+        ok = in.skip() && in.expect(',');
+
+    auto root = makeNode();
+    struct Open { FileNode* dir; std::uint64_t dev; };
+    std::vector<Open> stack;
+    std::uint64_t dev = 0;
+    ok = ok && in.expect('[') && readNcduEntry(in, *root, true, dev, key, name);
+    if (ok)
+        stack.push_back({ root.get(), dev });
+    while (ok && !stack.empty()) {
+        int c = in.get();
+        if (c == ']') {
+            stack.pop_back();
+            continue;
+        }
+        if (c != ',') {
+            ok = false;
+            break;
+        }
+        Open& parent = stack.back();
+        bool isDir = in.peek() == '[';
+        if (isDir)
+            in.get();
+        auto child = makeNode();
+        dev = parent.dev;
+        if (!readNcduEntry(in, *child, isDir, dev, key, name)) {
+            ok = false;
+            break;
+        }
+        child->parent = parent.dir;
+        FileNode* node = child.get();
+        parent.dir->children.push_back(std::move(child));
+        if (isDir)
+            stack.push_back({ node, dev });
+    }
+    if (!ok || !in.expect(']')) {
+        error = "malformed export near byte " + std::to_string(in.offset());
+        return nullptr;
+    }
+    return root;
+}
+
+std::shared_ptr<FileNode> importNcdu(const std::string& path, std::string& error) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        error = "cannot open " + path;
+        return nullptr;
+    }
+    return readNcdu(file, error);
+}
+
+// Append a JSON string, copying the runs between escapes in one go
+void putJsonString(std::string& out, std::string_view text) {
+    static const char hex[] = "0123456789abcdef";
+    out += '"';
+    std::size_t run = 0;
+    for (std::size_t i = 0; i < text.size(); ++i) {
+        unsigned char c = (unsigned char)text[i];
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+        out.append(text.data() + run, i - run);
+        run = i + 1;
+        if (c < 0x20) {
+            out += "\\u00";
+            out += hex[c >> 4];
+            out += hex[c & 15];
+        } else {
+            out += '\\';
+            out += char(c);
+        }
+    }
+    out.append(text.data() + run, text.size() - run);
+    out += '"';
+}
+
+// Write a tree as an ncdu export. Hard links already counted at another
+// path are written with zero sizes, as the tree keeps no inode numbers to
+// let ncdu tell the links apart; totals come out the same.
+bool writeNcdu(const FileNode& root, std::ostream& file, const std::string& rootName) {
+    TRACE_ZONE("writeNcdu");
+    SnapshotWriter out(file);
+    std::string line = "[1,2,{\"progname\":\"file-tree\",\"progver\":\"1.0\",\"timestamp\":" +
+                       std::to_string(std::time(nullptr)) + "},\n";
+    char number[24];
+    auto field = [&](const char* key, std::uint64_t value) {
+        line += key;
+        line.append(number, std::size_t(std::snprintf(number, sizeof(number), "%llu", (unsigned long long)value)));
+    };
+    auto entry = [&](const FileNode& node, std::string_view name) {
+        line += "{\"name\":";
+        putJsonString(line, name);
+        bool counted = !node.hardLinkSeen;
+        field(",\"asize\":", counted ? node.size : 0);
+        field(",\"dsize\":", counted ? node.allocated : 0);
+        if (node.user && node.group) {
+            field(",\"uid\":", users.ids[node.user]);
+            field(",\"gid\":", groups.ids[node.group]);
+        }
+        line += ",\"mtime\":";
+        line += std::to_string(node.mtime);
+        if (node.type == NodeType::Symlink || node.type == NodeType::Other)
+            line += ",\"notreg\":true";
+        line += '}';
+    };
+
+    // Each entry holds a directory and the index of its next child to write
+    std::vector<std::pair<const FileNode*, std::size_t>> stack;
+    line += '[';
+    entry(root, rootName);
+    stack.push_back({ &root, 0 });
+    while (!stack.empty()) {
+        auto& [dir, next] = stack.back();
+        if (line.size() >= 4096) {
+            out.bytes(line.data(), line.size());
+            line.clear();
+        }
+        if (next == dir->children.size()) {
+            line += ']';
+            stack.pop_back();
+            continue;
+        }
+        const FileNode& child = *dir->children[next++];
+        line += ",\n";
+        std::string_view name(child.name.data(), child.name.size());
+        if (child.type == NodeType::Directory) {
+            line += '[';
+            entry(child, name);
+            stack.push_back({ &child, 0 });
+        } else {
+            entry(child, name);
+        }
+    }
+    line += "]\n";
+    out.bytes(line.data(), line.size());
+    out.flush();
+    return bool(file);
+}
+
+bool exportNcdu(const FileNode& root, const std::string& path, const std::string& rootName) {
+    std::ofstream file(path, std::ios::binary);
+    return file && writeNcdu(root, file, rootName);
+}
+
+// ---- Row export ----
+// --export FILE streams the tree as one row per node for loading into other
+// tools: CSV when FILE ends in .csv, NDJSON otherwise (--export-format
+// overrides), and "-" for stdout. Rows come out in pre-order with
+//   id, parent, path, name, type, size, mtime, depth, leaves, x, y
+// where ids count nodes in that order, size is the subtree's apparent size
+// and x/y are where the window places the node with labels off and a Y
+// scale of 1. Nodes under a collapsed directory (as --diff and --history
+// start unchanged ones) are not placed and get an empty x/y, or null in
+// NDJSON. Rows are formatted into a reused buffer and each path is
+// extended from its parent's, so a row costs no heap allocation.
+
+enum class RowFormat { Csv, Ndjson };
+
+// Format implied by an export path
+RowFormat rowFormatFor(const std::string& path) {
+    std::size_t dot = path.rfind('.');
+    if (dot != std::string::npos && path.compare(dot, std::string::npos, ".csv") == 0)
+        return RowFormat::Csv;
+    return RowFormat::Ndjson;
+}
+
+const char* rowTypeName(NodeType type) {
+    switch (type) {
+    case NodeType::File:      return "file";
+    case NodeType::Directory: return "dir";
+    case NodeType::Symlink:   return "link";
+    default:                  return "other";
+    }
+}
+
+// Append a CSV field, quoted only when it has to be
+void putCsvField(std::string& out, std::string_view text) {
+    bool plain = true;
+    for (char ch : text)
+        plain &= ch != ',' && ch != '"' && ch != '\r' && ch != '\n';
+    if (plain) {
+        out += text;
+        return;
+    }
+    out += '"';
+    for (char ch : text) {
+        if (ch == '"')
+            out += '"';
+        out += ch;
+    }
+    out += '"';
+}
+
+template <typename T>
+void putNumber(std::string& out, T value) {
+    char number[32];
+    auto result = std::to_chars(number, number + sizeof(number), value);
+    out.append(number, result.ptr);
+}
+
+bool writeRows(const FileNode& root, std::ostream& file, RowFormat format, const std::string& rootName) {
+    TRACE_ZONE("writeRows");
+    SnapshotWriter out(file);
+    std::string line;
+    line.reserve(8192);
+    if (format == RowFormat::Csv)
+        line += "id,parent,path,name,type,size,mtime,depth,leaves,x,y\n";
+
+    const double slotWidth = HORIZONTAL_PADDING;
+    const double ySpacing = double(WINDOW_HEIGHT) / (root.height + 1);
+    // Per depth: where a node's path starts (its parent's path and a
+    // separator), the id of the last node seen, the next free layout slot,
+    // as in assignPositions, and whether the level is hidden by a collapsed
+    // ancestor
+    std::vector<std::size_t> pathStart(1, 0);
+    std::vector<std::uint64_t> lastId(1, 0);
+    std::vector<int> cursor(1, 0);
+    std::vector<char> hidden(1, 0);
+    std::string path;
+    std::uint64_t nextId = 0;
+    walkPreorder(root, [&](const FileNode& node, int depth) {
+        if (int(cursor.size()) <= depth + 1) {
+            pathStart.resize(depth + 2);
+            lastId.resize(depth + 2);
+            cursor.resize(depth + 2);
+            hidden.resize(depth + 2);
+        }
+        std::uint64_t id = nextId++;
+        lastId[depth] = id;
+        const bool placed = !hidden[depth];
+        hidden[depth + 1] = hidden[depth] || node.collapsed;
+        int origin = cursor[depth];
+        if (placed) {
+            cursor[depth] += node.leafCount;
+            cursor[depth + 1] = origin;
+        }
+
+        std::string_view name = depth ? std::string_view(node.name.data(), node.name.size())
+                                      : std::string_view(rootName);
+        path.resize(pathStart[depth]);
+        path += name;
+        if (!node.children.empty()) {
+            if (path.empty() || path.back() != '/')
+                path += '/';
+            pathStart[depth + 1] = path.size();
+        }
+        // A directory's path is written without the separator kept for its children
+        std::string_view rowPath(path.data(), node.children.empty() || path.size() == 1
+                                                  ? path.size() : path.size() - 1);
+
+        double x = (origin + node.relX) * slotWidth, y = depth * ySpacing;
+        if (format == RowFormat::Csv) {
+            putNumber(line, id);
+            line += ',';
+            if (depth)
+                putNumber(line, lastId[depth - 1]);
+            line += ',';
+            putCsvField(line, rowPath);
+            line += ',';
+            putCsvField(line, name);
+            line += ',';
+            line += rowTypeName(node.type);
+            line += ',';
+            putNumber(line, node.totalSize);
+            line += ',';
+            putNumber(line, node.mtime);
+            line += ',';
+            putNumber(line, depth);
+            line += ',';
+            putNumber(line, node.leafCount);
+            line += ',';
+            if (placed)
+                putNumber(line, x);
+            line += ',';
+            if (placed)
+                putNumber(line, y);
+        } else {
+            line += "{\"id\":";
+            putNumber(line, id);
+            line += ",\"parent\":";
+            if (depth)
+                putNumber(line, lastId[depth - 1]);
+            else
+                line += "null";
+            line += ",\"path\":";
+            putJsonString(line, rowPath);
+            line += ",\"name\":";
+            putJsonString(line, name);
+            line += ",\"type\":\"";
+            line += rowTypeName(node.type);
+            line += "\",\"size\":";
+            putNumber(line, node.totalSize);
+            line += ",\"mtime\":";
+            putNumber(line, node.mtime);
+            line += ",\"depth\":";
+            putNumber(line, depth);
+            line += ",\"leaves\":";
+            putNumber(line, node.leafCount);
+            if (placed) {
+                line += ",\"x\":";
+                putNumber(line, x);
+                line += ",\"y\":";
+                putNumber(line, y);
+                line += '}';
+            } else {
+                line += ",\"x\":null,\"y\":null}";
+            }
+        }
+        line += '\n';
+        if (line.size() >= 4096) {
+            out.bytes(line.data(), line.size());
+            line.clear();
+        }
+        return true;
+    });
+    out.bytes(line.data(), line.size());
+    out.flush();
+    return bool(file);
+}
+
+bool exportRows(const FileNode& root, const std::string& path, RowFormat format, const std::string& rootName) {
+    if (path == "-")
+        return writeRows(root, std::cout, format, rootName) && bool(std::cout.flush());
+    std::ofstream file(path, std::ios::binary);
+    return file && writeRows(root, file, format, rootName);
+}
+
+// ---- Benchmarks ----
+// --bench times each pipeline stage and prints one JSON document, so runs
+// can be compared between commits. Render cases draw into an offscreen
+// texture; on GPU-less Linux machines run under Xvfb, where Mesa's software
+// rasterizer is forced via LIBGL_ALWAYS_SOFTWARE.
+
+struct BenchOptions {
+    SyntheticParams synthetic;
+    fs::path realPath;              // optional real tree to scan
+    int iterations = 10;
+    std::string fontPath;
+};
+
+struct BenchResult {
+    std::string name;
+    std::uint64_t items = 0;        // work items per iteration (nodes, picks, ...)
+    std::vector<double> samplesMs;
+    long peakRssKb = 0;
+};
+
+// Peak resident set size of the process so far, in KiB
+long peakRssKb() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return long(counters.PeakWorkingSetSize / 1024);
+    return 0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+#endif
+}
+
+// Value below which the given fraction of the sorted samples fall
+double percentile(const std::vector<double>& sorted, double fraction) {
+    if (sorted.empty())
+        return 0.0;
+    std::size_t index = std::size_t(fraction * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+// Time a case. setup() runs untimed before every iteration; run() returns
+// the number of items it processed.
+template <typename Setup, typename Run>
+BenchResult runCase(const std::string& name, int iterations, Setup&& setup, Run&& run) {
+    std::cerr << "  " << name << "...\n";
+    BenchResult result;
+    result.name = name;
+    for (int i = 0; i < iterations; ++i) {
+        setup();
+        auto start = std::chrono::steady_clock::now();
+        result.items = run();
+        auto end = std::chrono::steady_clock::now();
+        result.samplesMs.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    result.peakRssKb = peakRssKb();
+    return result;
+}
+
+void writeBenchJson(std::ostream& out, const std::vector<BenchResult>& results,
+                    std::uint64_t treeNodes) {
+    out << "{\n  \"tree_nodes\": " << treeNodes << ",\n  \"cases\": [";
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        std::vector<double> sorted = r.samplesMs;
+        std::sort(sorted.begin(), sorted.end());
+        double mean = 0.0;
+        for (double ms : sorted)
+            mean += ms;
+        mean /= std::max<std::size_t>(1, sorted.size());
+        double p50 = percentile(sorted, 0.50);
+        char buf[512];
+        std::snprintf(buf, sizeof(buf),
+                      "%s\n    { \"name\": \"%s\", \"iterations\": %zu, \"items\": %llu, "
+                      "\"items_per_sec\": %.1f, \"mean_ms\": %.4f, \"p50_ms\": %.4f, "
+                      "\"p90_ms\": %.4f, \"p99_ms\": %.4f, \"min_ms\": %.4f, \"max_ms\": %.4f, "
+                      "\"peak_rss_kb\": %ld }",
+                      i ? "," : "", r.name.c_str(), sorted.size(), (unsigned long long)r.items,
+                      p50 > 0.0 ? r.items / (p50 / 1000.0) : 0.0, mean, p50,
+                      percentile(sorted, 0.90), percentile(sorted, 0.99),
+                      sorted.empty() ? 0.0 : sorted.front(), sorted.empty() ? 0.0 : sorted.back(),
+                      r.peakRssKb);
+        out << buf;
+    }
+    out << "\n  ]\n}\n";
+}
+
+// The recursive walks that walkPreorder and walkPostorder replaced, kept
+// as a baseline for the walk cases
+template <typename Visit>
+void walkPreorderRecursive(const FileNode& node, int depth, Visit& visit) {
+    if (!visit(node, depth))
+        return;
+    for (auto& c : node.children)
+        walkPreorderRecursive(*c, depth + 1, visit);
+}
+
+template <typename Visit>
+void walkPostorderRecursive(const FileNode& node, Visit& visit) {
+    for (auto& c : node.children)
+        walkPostorderRecursive(*c, visit);
+    visit(node);
+}
+
+int runBenchmarks(const BenchOptions& options) {
+    std::vector<BenchResult> results;
+    const int iters = std::max(1, options.iterations);
+    auto nothing = [] {};
+
+    // Scanning
+    std::shared_ptr<FileNode> root;
+    results.push_back(runCase("scan.synthetic", iters, [&] { root.reset(); }, [&] {
+        SyntheticSource source(options.synthetic);
+        root = buildTree(source);
+        computeLeafs(*root);
+        return root->descendants + 1;
+    }));
+    MemorySource memory;
+    {
+        SyntheticSource source(options.synthetic);
+        memory.copyFrom(source);
+    }
+    results.push_back(runCase("scan.memory", iters, [&] { root.reset(); }, [&] {
+        root = buildTree(memory);
+        return std::uint64_t(memory.size());
+    }));
+    if (!options.realPath.empty()) {
+        std::shared_ptr<FileNode> real;
+        results.push_back(runCase("scan.real", iters, [&] { real.reset(); }, [&] {
+            DiskSource source(options.realPath);
+            real = buildTree(source);
+            computeLeafs(*real);
+            return real->descendants + 1;
+        }));
+    }
+    memory = MemorySource();
+
+    // Layout
+    computeLeafs(*root);
+    const std::uint64_t nodes = root->descendants + 1;
+
+    // Walks, against the recursive versions. Both sum the same thing, so a
+    // difference means a walk visited the wrong nodes.
+    std::uint64_t sums[4] = {};
+    auto preorderSum = [](std::uint64_t& sum) {
+        return [&sum](const FileNode& node, int depth) {
+            sum += node.size + std::uint64_t(depth);
+            return true;
+        };
+    };
+    auto postorderSum = [](std::uint64_t& sum) {
+        return [&sum](const FileNode& node) { sum = sum * 31 + node.size; };
+    };
+    results.push_back(runCase("walk.preorder", iters, [&] { sums[0] = 0; }, [&] {
+        walkPreorder(static_cast<const FileNode&>(*root), preorderSum(sums[0]));
+        return nodes;
+    }));
+    results.push_back(runCase("walk.preorder.recursive", iters, [&] { sums[1] = 0; }, [&] {
+        auto visit = preorderSum(sums[1]);
+        walkPreorderRecursive(*root, 0, visit);
+        return nodes;
+    }));
+    results.push_back(runCase("walk.postorder", iters, [&] { sums[2] = 0; }, [&] {
+        walkPostorder(static_cast<const FileNode&>(*root), postorderSum(sums[2]));
+        return nodes;
+    }));
+    results.push_back(runCase("walk.postorder.recursive", iters, [&] { sums[3] = 0; }, [&] {
+        auto visit = postorderSum(sums[3]);
+        walkPostorderRecursive(*root, visit);
+        return nodes;
+    }));
+    if (sums[0] != sums[1] || sums[2] != sums[3]) {
+        std::cerr << "Explicit-stack walks disagree with the recursive ones.\n";
+        return 1;
+    }
+
+    // A chain of directories deep enough to overflow the call stack of a
+    // recursive walk, so it only runs the explicit-stack versions. Building,
+    // laying out and freeing the chain must all get through it.
+    {
+        SyntheticParams chain;
+        chain.depth = BENCH_CHAIN_DEPTH;
+        chain.fanout = 1.0;
+        chain.fanoutDist = SyntheticParams::Fanout::Fixed;
+        chain.dirRatio = 1.0;
+        std::shared_ptr<FileNode> deep;
+        results.push_back(runCase("walk.chain.build", iters, [&] { deep.reset(); }, [&] {
+            SyntheticSource source(chain);
+            deep = buildTree(source);
+            computeLeafs(*deep);
+            return deep->descendants + 1;
+        }));
+        if (deep->height != BENCH_CHAIN_DEPTH) {
+            std::cerr << "Chain is " << deep->height << " levels deep, expected "
+                      << BENCH_CHAIN_DEPTH << ".\n";
+            return 1;
+        }
+        const std::uint64_t chainNodes = deep->descendants + 1;
+        std::uint64_t sum = 0;
+        results.push_back(runCase("walk.chain.preorder", iters, nothing, [&] {
+            walkPreorder(static_cast<const FileNode&>(*deep), preorderSum(sum));
+            return chainNodes;
+        }));
+        results.push_back(runCase("walk.chain.postorder", iters, nothing, [&] {
+            walkPostorder(static_cast<const FileNode&>(*deep), postorderSum(sum));
+            return chainNodes;
+        }));
+        results.push_back(runCase("walk.chain.layout", iters, nothing, [&] {
+            assignPositions(*deep, 0, 100.0, 50.0);
+            return chainNodes;
+        }));
+    }
+
+    results.push_back(runCase("layout.computeLeafs", iters, nothing, [&] {
+        computeLeafs(*root);
+        return nodes;
+    }));
+    results.push_back(runCase("layout.computeLeafs.top", iters, nothing, [&] {
+        TopReport top(100);
+        computeLeafs(*root, &top);
+        return nodes;
+    }));
+    results.push_back(runCase("layout.computeLeafs.owners", iters, nothing, [&] {
+        OwnerReport owners;
+        computeLeafs(*root, nullptr, &owners);
+        return nodes;
+    }));
+    // Queries: columns are built once per tree, then each run is one pass
+    // over them plus one per glob term
+    NodeColumns columns;
+    results.push_back(runCase("query.columns", iters, nothing, [&] {
+        buildColumns(columns, *root);
+        return nodes;
+    }));
+    for (const char* expression : { "type = file and size > 64K and age > 30d",
+                                    "type = file and path ~ \"*/a*/*.o\"" }) {
+        Query query;
+        std::string error;
+        QueryCompiler(expression, std::int64_t(std::time(nullptr))).compile(query, error);
+        FilterResult filter;
+        results.push_back(runCase(query.globs.empty() ? "query.compare" : "query.glob", iters, nothing, [&] {
+            runQuery(query, columns, filter);
+            return nodes;
+        }));
+    }
+    columns = NodeColumns();
+    const double slotWidth = 100.0, ySpacing = 50.0;
+    // ncdu export and import, through memory so disk speed does not count
+    std::string ncdu;
+    results.push_back(runCase("ncdu.write", iters, nothing, [&] {
+        std::ostringstream out;
+        writeNcdu(*root, out, root->name.c_str());
+        ncdu = out.str();
+        return nodes;
+    }));
+    results.push_back(runCase("ncdu.read", iters, nothing, [&] {
+        std::istringstream in(ncdu);
+        std::string error;
+        std::shared_ptr<FileNode> imported = readNcdu(in, error);
+        return imported ? nodes : 0;
+    }));
+    ncdu = std::string();
+    // Row export, also through memory
+    for (RowFormat format : { RowFormat::Csv, RowFormat::Ndjson }) {
+        results.push_back(runCase(format == RowFormat::Csv ? "export.csv" : "export.ndjson", iters, nothing, [&] {
+            std::ostringstream out;
+            writeRows(*root, out, format, root->name.c_str());
+            return nodes;
+        }));
+    }
+    results.push_back(runCase("layout.assignPositions", iters, nothing, [&] {
+        assignPositions(*root, 0, slotWidth, ySpacing);
+        return nodes;
+    }));
+
+    // Labels; the glyph atlas needs a GL context, so pick software GL first
+#ifndef _WIN32
+    setenv("LIBGL_ALWAYS_SOFTWARE", "1", 0);
+#endif
+    sf::Font font;
+    bool haveFont = font.loadFromFile(options.fontPath);
+    const std::array<bool, 256> used = usedNameBytes(*root);
+    std::unique_ptr<GlyphAtlas> atlas;
+    if (haveFont) {
+        results.push_back(runCase("labels.measure", iters, nothing, [&] {
+            measureLabels(*root, font);
+            return nodes;
+        }));
+        results.push_back(runCase("labels.atlas", iters, [&] { atlas.reset(); }, [&] {
+            atlas = std::make_unique<GlyphAtlas>(font, used);
+            return std::uint64_t(256);
+        }));
+    } else {
+        std::cerr << "  (no font at " << options.fontPath << ", skipping label cases)\n";
+        atlas = std::make_unique<GlyphAtlas>(font, used);
+    }
+
+    // Picking: a fixed set of random points across the tree's extent
+    const double worldWidth = slotWidth * root->leafCount;
+    const double worldHeight = ySpacing * (root->height + 1);
+    std::vector<WorldPos> probes;
+    SplitMix rng(options.synthetic.seed);
+    for (int i = 0; i < 100; ++i)
+        probes.emplace_back(rng.uniform() * worldWidth, rng.uniform() * worldHeight);
+    results.push_back(runCase("pick.nearest", iters, nothing, [&] {
+        for (auto& p : probes)
+            pickNearest(*root, p);
+        return std::uint64_t(probes.size());
+    }));
+
+    // Geometry generation: a full snapshot, and the per-zoom repositioning
+    FrameState state;
+    state.focus = root.get();
+    state.camera = WorldPos(worldWidth / 2.0, worldHeight / 2.0);
+    state.zoom = float(worldWidth) / WINDOW_WIDTH;
+    SceneSnapshot edges, labels;
+    RenderBuffers buffers;
+    results.push_back(runCase("geometry.edges", iters, nothing, [&] {
+        buildSnapshot(edges, state, *atlas, WINDOW_WIDTH);
+        return std::uint64_t(edges.edgePoints.size() / 2);
+    }));
+    results.push_back(runCase("geometry.place", iters, nothing, [&] {
+        placeScene(buffers, edges, state.camera, state.zoom);
+        return std::uint64_t(edges.edgePoints.size() / 2);
+    }));
+    TypeHistogram histogram;
+    results.push_back(runCase("types.histogram", iters, nothing, [&] {
+        histogram = typeHistogram(*root);
+        return nodes;
+    }));
+    std::shared_ptr<const Palette> palettes[2] = {
+        buildPalette(PaletteMode::Extension, histogram, OwnerReport(), font),
+        buildPalette(PaletteMode::Kind, histogram, OwnerReport(), font) };
+    std::size_t recolours = 0;
+    results.push_back(runCase("geometry.recolour", iters, nothing, [&] {
+        colourEdges(buffers, edges, palettes[recolours++ % 2].get());
+        return std::uint64_t(edges.edgePoints.size() / 2);
+    }));
+    FrameState labelled = state;
+    labelled.drawLabels = true;
+    if (haveFont) {
+        results.push_back(runCase("geometry.labels", iters, nothing, [&] {
+            buildSnapshot(labels, labelled, *atlas, WINDOW_WIDTH);
+            return std::uint64_t(labels.labelSpans.size());
+        }));
+    }
+
+    // Rendering into an offscreen target, snapshots already built
+    sf::RenderTexture offscreen;
+    if (offscreen.create(WINDOW_WIDTH, WINDOW_HEIGHT)) {
+        sf::View view(sf::Vector2f(0.f, 0.f), sf::Vector2f(float(worldWidth), float(worldHeight)));
+        auto frame = [&](const FrameState& frameState, const SceneSnapshot& scene) {
+            return [&, frameState] {
+                renderFrame(offscreen, view, frameState, scene, *atlas, buffers);
+                offscreen.display();
+                glFinish();
+                return nodes;
+            };
+        };
+        results.push_back(runCase("render.edges", iters, nothing, frame(state, edges)));
+        if (haveFont)
+            results.push_back(runCase("render.labels", iters, nothing, frame(labelled, labels)));
+    } else {
+        std::cerr << "  (no offscreen GL context, skipping render cases)\n";
+    }
+
+    writeBenchJson(std::cout, results, nodes);
+    return 0;
+}
+
+// ---- Headless frame benchmark ----
+// --headless SCRIPT renders into an offscreen texture while replaying a
+// camera script, and reports per-frame CPU time, draw calls and vertices.
+// SCRIPT is one of the built-in names below or a file of commands, one per
+// line:
+//   fit                  frame the whole tree
+//   goto FX FY           centre on a fraction of the tree's width/height
+//   zoom FACTOR FRAMES   multiply the zoom by FACTOR every frame
+//   pan DX DY FRAMES     move DX/DY screen pixels every frame
+//   labels on|off        show or hide all labels
+//   hold FRAMES          render without moving
+// With --assert-zero-alloc the run fails if any frame past the first few
+// allocates on the heap without having had to rebuild its geometry.
+
+const char* builtinScript(const std::string& name) {
+    if (name == "zoom-sweep")
+        return "fit\nzoom 0.95 120\nzoom 1.0526 120\n";
+    if (name == "fast-pan")
+        return "fit\nzoom 0.05 1\ngoto 0 0.5\npan 60 0 240\npan -60 0 240\n";
+    if (name == "label-toggle")
+        return "fit\nzoom 0.2 1\nlabels on\nhold 30\nlabels off\nhold 30\n"
+               "labels on\npan 20 0 30\nlabels off\npan 20 0 30\n";
+    return nullptr;
+}
+
+struct FrameSample {
+    double cpuMs;                   // time to build and submit the frame
+    double frameMs;                 // including waiting for the GPU
+    FrameStats stats;
+};
+
+int runHeadless(FileNode& root, const sf::Font& font, bool haveFont,
+                const std::string& scriptName, float yScale, std::ostream* memReport,
+                bool assertZeroAlloc, bool allowSdf, const FilterResult* filter) {
+    std::string script;
+    if (const char* builtin = builtinScript(scriptName)) {
+        script = builtin;
+    } else {
+        std::ifstream file(scriptName);
+        if (!file) {
+            std::cerr << "Unknown script: " << scriptName << '\n';
+            return 1;
+        }
+        script.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+#ifndef _WIN32
+    setenv("LIBGL_ALWAYS_SOFTWARE", "1", 0);
+#endif
+    sf::RenderTexture target;
+    if (!target.create(WINDOW_WIDTH, WINDOW_HEIGHT)) {
+        std::cerr << "Failed to create offscreen render target.\n";
+        return 1;
+    }
+
+    const GlyphAtlas atlas(font, usedNameBytes(root), allowSdf);
+
+    // Labels may be switched on by the script, so lay out with room for them
+    float slotWidth = (haveFont ? measureLabels(root, font) : 0.f) + HORIZONTAL_PADDING;
+    double ySpacing = double(yScale) * WINDOW_HEIGHT / (root.height + 1);
+    assignPositions(root, 0, slotWidth, ySpacing);
+    const double worldWidth = double(slotWidth) * root.leafCount;
+    const double worldHeight = ySpacing * (root.height + 1);
+    if (memReport)
+        printMemoryReport(*memReport, "layout", root.descendants + 1);
+
+    FrameState state;
+    state.focus = &root;
+    state.filter = filter;
+    state.camera = WorldPos(worldWidth / 2.0, worldHeight / 2.0);
+    sf::View worldView(sf::Vector2f(0.f, 0.f), sf::Vector2f(float(WINDOW_WIDTH), float(WINDOW_HEIGHT)));
+    auto setZoom = [&](float zoom) {
+        state.zoom = zoom;
+        worldView.setSize(WINDOW_WIDTH * zoom, WINDOW_HEIGHT * zoom);
+    };
+
+    std::vector<FrameSample> samples;
+    SceneSnapshot scene;
+    RenderBuffers buffers;
+    auto renderOne = [&] {
+        std::uint64_t allocations = threadHeapAllocations;
+        auto start = std::chrono::steady_clock::now();
+        if (snapshotStale(scene, state, target.getSize().x))
+            buildSnapshot(scene, state, atlas, target.getSize().x);
+        renderFrame(target, worldView, state, scene, atlas, buffers);
+        target.display();
+        auto submitted = std::chrono::steady_clock::now();
+        glFinish();
+        auto done = std::chrono::steady_clock::now();
+        perfCount(Allocations, threadHeapAllocations - allocations);
+        samples.push_back({ std::chrono::duration<double, std::milli>(submitted - start).count(),
+                            std::chrono::duration<double, std::milli>(done - start).count(),
+                            frameStats });
+    };
+
+    std::istringstream lines(script);
+    std::string line;
+    while (std::getline(lines, line)) {
+        std::istringstream in(line);
+        std::string command;
+        if (!(in >> command) || command[0] == '#')
+            continue;
+        if (command == "fit") {
+            setZoom(float(std::max(worldWidth / WINDOW_WIDTH, worldHeight / WINDOW_HEIGHT)));
+            state.camera = WorldPos(worldWidth / 2.0, worldHeight / 2.0);
+        } else if (command == "goto") {
+            double fx = 0.5, fy = 0.5;
+            in >> fx >> fy;
+            state.camera = WorldPos(fx * worldWidth, fy * worldHeight);
+        } else if (command == "zoom") {
+            float factor = 1.f;
+            int frames = 1;
+            in >> factor >> frames;
+            for (int i = 0; i < frames; ++i) {
+                setZoom(state.zoom * factor);
+                renderOne();
+            }
+        } else if (command == "pan") {
+            double dx = 0.0, dy = 0.0;
+            int frames = 1;
+            in >> dx >> dy >> frames;
+            for (int i = 0; i < frames; ++i) {
+                state.camera.x += dx * state.zoom;
+                state.camera.y += dy * state.zoom;
+                renderOne();
+            }
+        } else if (command == "labels") {
+            std::string mode;
+            in >> mode;
+            state.drawLabels = haveFont && mode == "on";
+        } else if (command == "hold") {
+            int frames = 1;
+            in >> frames;
+            for (int i = 0; i < frames; ++i)
+                renderOne();
+        } else {
+            std::cerr << "Unknown script command: " << command << '\n';
+            return 1;
+        }
+    }
+
+    // The first frames fill buffers and the font's glyph cache; after that a
+    // frame that did not rebuild its geometry should not touch the heap
+    const std::size_t warmup = 3;
+    std::vector<double> frameMs;
+    double cpuTotal = 0.0, drawTotal = 0.0, vertexTotal = 0.0;
+    std::uint64_t steadyFrames = 0, steadyAllocations = 0;
+    for (std::size_t i = 0; i < samples.size(); ++i) {
+        const FrameSample& sample = samples[i];
+        frameMs.push_back(sample.frameMs);
+        cpuTotal += sample.cpuMs;
+        drawTotal += double(sample.stats[DrawCalls]);
+        vertexTotal += double(sample.stats[Vertices]);
+        if (i >= warmup && sample.stats[Rebuilds] == 0) {
+            ++steadyFrames;
+            steadyAllocations += sample.stats[Allocations];
+        }
+    }
+    std::sort(frameMs.begin(), frameMs.end());
+    double count = double(std::max<std::size_t>(1, samples.size()));
+
+    std::printf("{\n  \"script\": \"%s\",\n  \"nodes\": %llu,\n  \"frames\": %zu,\n"
+                "  \"p50_ms\": %.4f,\n  \"p95_ms\": %.4f,\n  \"p99_ms\": %.4f,\n"
+                "  \"mean_cpu_ms\": %.4f,\n  \"mean_draw_calls\": %.1f,\n  \"mean_vertices\": %.1f,\n"
+                "  \"steady_frames\": %llu,\n  \"steady_allocations\": %llu,\n"
+                "  \"per_frame\": [",
+                scriptName.c_str(), (unsigned long long)(root.descendants + 1), samples.size(),
+                percentile(frameMs, 0.50), percentile(frameMs, 0.95), percentile(frameMs, 0.99),
+                cpuTotal / count, drawTotal / count, vertexTotal / count,
+                (unsigned long long)steadyFrames, (unsigned long long)steadyAllocations);
+    for (std::size_t i = 0; i < samples.size(); ++i)
+        std::printf("%s\n    { \"cpu_ms\": %.4f, \"frame_ms\": %.4f, \"draw_calls\": %llu, \"vertices\": %llu, "
+                    "\"rebuilds\": %llu, \"allocations\": %llu }",
+                    i ? "," : "", samples[i].cpuMs, samples[i].frameMs,
+                    (unsigned long long)samples[i].stats[DrawCalls],
+                    (unsigned long long)samples[i].stats[Vertices],
+                    (unsigned long long)samples[i].stats[Rebuilds],
+                    (unsigned long long)samples[i].stats[Allocations]);
+    std::printf("\n  ]\n}\n");
+
+    if (assertZeroAlloc && steadyAllocations) {
+        std::cerr << steadyAllocations << " heap allocations in " << steadyFrames
+                  << " steady-state frames\n";
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    // Options come first; anything else is the root folder path
+    //   --synthetic key=value,...  scan a generated tree instead of the disk
+    //   --latency-us N             delay every directory read by N microseconds
+    //   --font PATH                font for labels
+    //   --bench [--iterations N]   run the benchmark suite on the synthetic tree
+    //                              (and on the root path, if given) and exit
+    //   --headless SCRIPT          replay a camera script offscreen and report
+    //                              frame times (see runHeadless)
+    //   --assert-zero-alloc        with --headless, fail if steady-state
+    //                              frames allocate on the heap
+    //   --save FILE                write the scan to a snapshot file
+    //   --diff OLD NEW             view what changed between two snapshots
+    //                              instead of scanning
+    //   --import-ncdu FILE         view an ncdu JSON export instead of scanning
+    //   --export-ncdu FILE         write the scan as an ncdu JSON export
+    //   --export FILE              write one row per node as CSV or NDJSON
+    //                              (see Row export) and exit, unless
+    //                              --headless is given too
+    //   --export-format csv|ndjson override the format FILE's name implies
+    //   --store FILE               append the scan to a snapshot store
+    //   --history FILE [--version N]
+    //                              view version N (default: the latest) of a
+    //                              snapshot store instead of scanning; Left and
+    //                              Right or the slider move between versions
+    //   --filter EXPR              mark the nodes matching EXPR (see Queries)
+    //                              and fade the rest; H hides them instead
+    //   --top K                    print the K largest files and directories;
+    //                              in the window, T cycles through the lists
+    //   --types N                  print the N file extensions holding the
+    //                              most bytes; in the window, C colours edges
+    //                              by extension, kind of file or owner
+    //   --owners N                 print usage per user and group, and the
+    //                              owners of the N largest top-level directories
+    //   --duplicates               hash files to find duplicate sets, report
+    //                              them and highlight them in the view
+    //   --no-sdf                   draw labels from the font's bitmaps instead
+    //                              of the distance-field atlas
+    //   --mem-report               print memory use per subsystem after the
+    //                              scan and after layout
+    //   --trace FILE               record a Chrome trace (chrome://tracing,
+    //                              Perfetto) of the run into FILE
+    fs::path rootPath;
+    std::string syntheticSpec;
+    std::string fontPath = FONT_PATH;
+    long latencyUs = 0;
+    bool benchMode = false;
+    std::string headlessScript;
+    std::string tracePath;
+    bool memReport = false;
+    bool allowSdf = true;
+    bool findDups = false;
+    std::string savePath, diffOld, diffNew;
+    std::string storePath, historyPath;
+    std::string ncduImport, ncduExport;
+    std::string exportPath, exportFormat;
+    long historyVersion = 0;
+    std::string filterText;
+    long topCount = 0;
+    long typeCount = 0;
+    long ownerCount = 0;
+    bool assertZeroAlloc = false;
+    int benchIterations = 10;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--synthetic" && i + 1 < argc)
+            syntheticSpec = argv[++i];
+        else if (arg == "--latency-us" && i + 1 < argc)
+            latencyUs = std::atol(argv[++i]);
+        else if (arg == "--font" && i + 1 < argc)
+            fontPath = argv[++i];
+        else if (arg == "--bench")
+            benchMode = true;
+        else if (arg == "--headless" && i + 1 < argc)
+            headlessScript = argv[++i];
+        else if (arg == "--trace" && i + 1 < argc)
+            tracePath = argv[++i];
+        else if (arg == "--save" && i + 1 < argc)
+            savePath = argv[++i];
+        else if (arg == "--diff" && i + 2 < argc) {
+            diffOld = argv[++i];
+            diffNew = argv[++i];
+        }
+        else if (arg == "--import-ncdu" && i + 1 < argc)
+            ncduImport = argv[++i];
+        else if (arg == "--export-ncdu" && i + 1 < argc)
+            ncduExport = argv[++i];
+        else if (arg == "--export" && i + 1 < argc)
+            exportPath = argv[++i];
+        else if (arg == "--export-format" && i + 1 < argc)
+            exportFormat = argv[++i];
+        else if (arg == "--store" && i + 1 < argc)
+            storePath = argv[++i];
+        else if (arg == "--history" && i + 1 < argc)
+            historyPath = argv[++i];
+        else if (arg == "--version" && i + 1 < argc)
+            historyVersion = std::atol(argv[++i]);
+        else if (arg == "--filter" && i + 1 < argc)
+            filterText = argv[++i];
+        else if (arg == "--top" && i + 1 < argc)
+            topCount = std::max(0L, std::atol(argv[++i]));
+        else if (arg == "--types" && i + 1 < argc)
+            typeCount = std::max(0L, std::atol(argv[++i]));
+        else if (arg == "--owners" && i + 1 < argc)
+            ownerCount = std::max(0L, std::atol(argv[++i]));
+        else if (arg == "--duplicates")
+            findDups = true;
+        else if (arg == "--no-sdf")
+            allowSdf = false;
+        else if (arg == "--mem-report")
+            memReport = true;
+        else if (arg == "--assert-zero-alloc")
+            assertZeroAlloc = true;
+        else if (arg == "--iterations" && i + 1 < argc)
+            benchIterations = std::atoi(argv[++i]);
+        else if (rootPath.empty())
+            rootPath = fs::absolute(arg);
+    }
+
+    TraceSession traceSession(tracePath);
+
+    if (benchMode) {
+        BenchOptions options;
+        options.synthetic.depth = 12;
+        options.synthetic.dirRatio = 0.3;
+        options.synthetic.maxNodes = 200000;
+        if (!syntheticSpec.empty() && !parseSyntheticParams(syntheticSpec, options.synthetic)) {
+            std::cerr << "Invalid synthetic tree parameters.\n";
+            return 1;
+        }
+        options.realPath = rootPath;
+        options.iterations = benchIterations;
+        options.fontPath = fontPath;
+        return runBenchmarks(options);
+    }
+
+    // A bad filter is reported before the scan rather than after it
+    Query query;
+    if (!filterText.empty()) {
+        std::string error;
+        if (!QueryCompiler(filterText, std::int64_t(std::time(nullptr))).compile(query, error)) {
+            std::cerr << "Invalid filter: " << error << ".\n";
+            return 1;
+        }
+    }
+
+    if (!exportFormat.empty() && exportFormat != "csv" && exportFormat != "ndjson") {
+        std::cerr << "Unknown export format '" << exportFormat << "'.\n";
+        return 1;
+    }
+
+    std::unique_ptr<FsSource> source;
+    // An export runs without the window
+    bool interactive = headlessScript.empty() && exportPath.empty();
+    diffMode = !diffOld.empty();
+    if (diffMode || !historyPath.empty() || !ncduImport.empty()) {
+        // Nothing to scan: the tree comes from snapshots or an export
+    } else if (!syntheticSpec.empty()) {
+        SyntheticParams params;
+        if (!parseSyntheticParams(syntheticSpec, params)) {
+            std::cerr << "Invalid synthetic tree parameters.\n";
+            return 1;
+        }
+        source = std::make_unique<SyntheticSource>(params);
+    } else {
+        // Determine root folder path from drag-and-drop or prompt
+        if (!rootPath.empty()) {
+            (interactive ? std::cout : std::cerr) << "Opening (dropped) path: " << rootPath << std::endl;
+        } else if (!interactive) {
+            std::cerr << "No root path given.\n";
+            return 1;
+        } else {
+            std::cout << "Enter root folder path: ";
+            std::string input;
+            std::getline(std::cin, input);
+            rootPath = fs::absolute(input);
+        }
+
+        if (!fs::exists(rootPath) || !fs::is_directory(rootPath)) {
+            std::cerr << "Invalid path.\n";
+            return 1;
+        }
+        source = std::make_unique<DiskSource>(rootPath);
+    }
+    if (latencyUs > 0 && source)
+        source = std::make_unique<SlowSource>(std::move(source), std::chrono::microseconds(latencyUs));
+
+    // Keep stdout clean for the JSON report in headless mode
+    std::ostream& status = interactive ? std::cout : std::cerr;
+    std::shared_ptr<FileNode> root;
+    DiffSummary diffSummary;
+    // The window's panel shows TOP_COUNT entries per list
+    TopReport top(std::size_t(std::max<long>(topCount, interactive ? TOP_COUNT : 0)));
+    TopReport* topReport = top.lists[0].limit ? &top : nullptr;
+    // Owners are summed for the report and for colouring the window by owner
+    OwnerReport owners;
+    OwnerReport* ownerReport = ownerCount || interactive ? &owners : nullptr;
+    SnapshotStore history(historyPath);
+    StoreTree historyTree;
+    if (!historyPath.empty()) {
+        status << "Loading history...";
+        PhaseTimer timer("load version");
+        if (!history.open() || history.versions() == 0) {
+            std::cerr << "\nNo snapshot store at " << historyPath << ".\n";
+            return 1;
+        }
+        std::size_t version = history.versions() - 1;
+        if (historyVersion > 0)
+            version = std::min(version, std::size_t(historyVersion - 1));
+        if (!history.load(version, historyTree)) {
+            std::cerr << "\nFailed to read version " << version + 1 << " of " << historyPath << ".\n";
+            return 1;
+        }
+        root = historyTree.root;
+        if (topReport || ownerReport)
+            computeLeafs(*root, topReport, ownerReport);
+    } else if (!ncduImport.empty()) {
+        status << "Importing...";
+        std::string error;
+        {
+            PhaseTimer timer("import ncdu");
+            root = importNcdu(ncduImport, error);
+        }
+        if (!root) {
+            std::cerr << "\nFailed to import " << ncduImport << ": " << error << ".\n";
+            return 1;
+        }
+        PhaseTimer timer("leaf counts");
+        computeLeafs(*root, topReport, ownerReport);
+    } else if (diffMode) {
+        status << "Loading snapshots...";
+        std::shared_ptr<FileNode> before;
+        {
+            PhaseTimer timer("load snapshots");
+            before = loadSnapshot(diffOld);
+            root = loadSnapshot(diffNew);
+        }
+        if (!before || !root) {
+            std::cerr << "\nFailed to read snapshot " << (before ? diffNew : diffOld) << ".\n";
+            return 1;
+        }
+        PhaseTimer timer("diff");
+        computeLeafs(*before);
+        computeLeafs(*root);
+        diffSummary = diffTrees(*before, *root);
+        before.reset();
+        computeLeafs(*root, topReport, ownerReport);
+    } else {
+        status << "Building tree...";
+        {
+            PhaseTimer timer("scan");
+            root = buildTree(*source);
+        }
+        {
+            PhaseTimer timer("leaf counts");
+            computeLeafs(*root, topReport, ownerReport);
+        }
+    }
+    status << "Done! " << root->fileCount << " files, "
+              << formatBytes(root->totalSize) << " ("
+              << formatBytes(root->totalAllocated) << " on disk)" << std::endl;
+    if (diffMode)
+        printDiffSummary(status, diffSummary);
+    // Columns are built once per tree and kept for every query run over it
+    NodeColumns columns;
+    FilterResult filter;
+    auto rebuildColumns = [&] {
+        if (filterText.empty())
+            return;
+        PhaseTimer timer("query columns");
+        buildColumns(columns, *root);
+    };
+    auto applyFilter = [&] {
+        if (filterText.empty())
+            return;
+        auto start = std::chrono::steady_clock::now();
+        runQuery(query, columns, filter);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        status << "Filter: " << filter.count << " of " << columns.size() << " match ("
+               << ms << " ms)" << std::endl;
+    };
+    rebuildColumns();
+    applyFilter();
+    if (topCount)
+        printTopReport(status, top, std::size_t(topCount));
+    if (typeCount) {
+        PhaseTimer timer("type histogram");
+        printTypeHistogram(status, typeHistogram(*root), std::size_t(typeCount));
+    }
+    if (ownerCount)
+        printOwnerReport(status, owners, *root, std::size_t(ownerCount));
+    if (memReport)
+        printMemoryReport(status, "scan", root->descendants + 1);
+    if (!savePath.empty()) {
+        PhaseTimer timer("save snapshot");
+        if (diffMode)
+            std::cerr << "--save writes scans, not diffs.\n";
+        else if (saveSnapshot(*root, savePath))
+            status << "Snapshot written to " << savePath << std::endl;
+        else
+            std::cerr << "Failed to write snapshot " << savePath << ".\n";
+    }
+    if (!ncduExport.empty()) {
+        PhaseTimer timer("export ncdu");
+        std::string rootName = source && !rootPath.empty() ? rootPath.string() : std::string(root->name.c_str());
+        if (diffMode)
+            std::cerr << "--export-ncdu writes scans, not diffs.\n";
+        else if (exportNcdu(*root, ncduExport, rootName))
+            status << "ncdu export written to " << ncduExport << std::endl;
+        else
+            std::cerr << "Failed to write " << ncduExport << ".\n";
+    }
+    if (!exportPath.empty()) {
+        PhaseTimer timer("export rows");
+        std::string rootName = source && !rootPath.empty() ? rootPath.string() : std::string(root->name.c_str());
+        RowFormat format = exportFormat.empty() ? rowFormatFor(exportPath)
+                         : exportFormat == "csv" ? RowFormat::Csv : RowFormat::Ndjson;
+        if (diffMode) {
+            std::cerr << "--export writes scans, not diffs.\n";
+        } else if (!exportRows(*root, exportPath, format, rootName)) {
+            std::cerr << "Failed to write " << exportPath << ".\n";
+            return 1;
+        } else if (exportPath != "-") {
+            status << "Rows written to " << exportPath << std::endl;
+        }
+    }
+    if (!storePath.empty()) {
+        PhaseTimer timer("store");
+        SnapshotStore store(storePath);
+        std::uint64_t bytes = 0;
+        if (diffMode || !historyPath.empty())
+            std::cerr << "--store takes scans, not snapshots.\n";
+        else if (!store.open())
+            std::cerr << storePath << " is not a snapshot store.\n";
+        else if (store.append(*root, std::int64_t(std::time(nullptr)), bytes))
+            status << "Stored version " << store.versions() << " in " << storePath << " ("
+                   << ((store.versions() - 1) % STORE_KEYFRAME ? "delta, " : "base, ")
+                   << formatBytes(bytes) << ")" << std::endl;
+        else
+            std::cerr << "Failed to append to " << storePath << ".\n";
+    }
+    if (findDups) {
+        if (rootPath.empty() || !syntheticSpec.empty()) {
+            std::cerr << "--duplicates needs a real directory to read.\n";
+        } else {
+            PhaseTimer timer("duplicates");
+            printDuplicateReport(status, findDuplicates(*root, rootPath, DUP_IO_LIMIT), rootPath, 10);
+        }
+    }
+
+    if (!interactive && headlessScript.empty())
+        return 0;
+    if (!interactive) {
+        sf::Font font;
+        bool haveFont = font.loadFromFile(fontPath);
+        if (haveFont)
+            font.setSmooth(true);
+        return runHeadless(*root, font, haveFont, headlessScript, 1.f,
+                           memReport ? &status : nullptr, assertZeroAlloc, allowSdf,
+                           filterText.empty() ? nullptr : &filter);
+    }
+
+    std::cout << "Draw labels? (1/0): ";
+    int isDrawLabels = 0;
+    std::cin >> isDrawLabels;
+    std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+
+    std::cout << "Y scale: ";
+    float yScale;
+    std::cin >> yScale;
+
+    // Load font (for both labels and right-click display)
+    sf::Font font;
+    if (!font.loadFromFile(fontPath)) {
+        std::cerr << "Failed to load font.\n";
+        return 1;
+    }
+    font.setSmooth(true);
+
+    // Measure max text width if drawing labels
+    float maxTextW = 0.f;
+    if (isDrawLabels) {
+        PhaseTimer timer("label measure");
+        maxTextW = measureLabels(*root, font);
+    }
+
+    float slotWidth = maxTextW + HORIZONTAL_PADDING;
+
+    // Layout and drawing start at the focused node, which can be any
+    // subtree of the scan
+    FileNode* focus = root.get();
+    double ySpacing = 0.0;
+    double worldWidth = 0.0;
+    auto relayout = [&]() {
+        PhaseTimer timer("layout");
+        ySpacing = double(yScale) * WINDOW_HEIGHT / (focus->height + 1);
+        assignPositions(*focus, 0, slotWidth, ySpacing);
+        worldWidth = slotWidth * focus->leafCount;
+    };
+    relayout();
+    if (memReport)
+        printMemoryReport(std::cout, "layout", root->descendants + 1);
+
+    // For storing the node selected by right-click
+    FileNode* selectedNode = nullptr;
+
+    bool isFullscreen = false;
+    sf::VideoMode windowedMode(WINDOW_WIDTH, WINDOW_HEIGHT);
+    const char* windowTitle = "File Tree";
+
+    sf::RenderWindow window(windowedMode, windowTitle, sf::Style::Close);
+    window.setFramerateLimit(60);
+
+    // The view stays centred on the origin; the camera position is kept in
+    // world space and subtracted from geometry before it reaches SFML
+    sf::View worldView = window.getDefaultView();
+    worldView.setCenter(0.f, 0.f);
+    WorldPos camera(worldWidth / 2.0, WINDOW_HEIGHT / 2.0);
+    float currentZoom = 1.f;
+
+    // World position under a window pixel
+    auto pixelToWorld = [&](sf::Vector2i pixel) {
+        sf::Vector2f offset = window.mapPixelToCoords(pixel, worldView);
+        return WorldPos(camera.x + offset.x, camera.y + offset.y);
+    };
+
+
+    // Fold or unfold a node and keep it under the same screen position
+    auto toggleNode = [&](FileNode* node) {
+        if (!node || node->children.empty())
+            return;
+        double oldX = node->x;
+        if (isUnder(*node, *focus) && !isHidden(*node)) {
+            PhaseTimer timer("layout");
+            toggleAndShift(*node, *focus, slotWidth, ySpacing);
+            worldWidth = slotWidth * focus->leafCount;
+        } else {
+            toggleCollapse(*node);
+            relayout();
+        }
+        camera.x += node->x - oldX;
+        if (selectedNode && isHidden(*selectedNode))
+            selectedNode = nullptr;
+    };
+
+    // Re-root layout and drawing at another node of the scanned tree
+    auto setFocus = [&](FileNode* node) {
+        if (!node || node == focus || node->children.empty())
+            return;
+        if (node->collapsed)
+            toggleCollapse(*node);
+        focus = node;
+        relayout();
+        if (selectedNode && (!isUnder(*selectedNode, *focus) || isHidden(*selectedNode)))
+            selectedNode = nullptr;
+        currentZoom = 1.f;
+        worldView.setSize(window.getDefaultView().getSize());
+        camera = WorldPos(worldWidth / 2.0, WINDOW_HEIGHT / 2.0);
+    };
+
+    // Show an entry of a top list: focus on it, or on the directory holding
+    // it, then select it and centre the camera on it
+    auto jumpTo = [&](FileNode* node) {
+        FileNode* dir = node->children.empty() && node->parent ? node->parent : node;
+        if (dir != focus)
+            setFocus(dir);
+        if (dir != focus)
+            return;
+        if (dir->collapsed)
+            toggleNode(dir);
+        selectedNode = node;
+        camera = WorldPos(node->x, node->y);
+    };
+
+    // Edge colours by file type or owner; rebuilt when the tree changes
+    PaletteMode paletteMode = PaletteMode::Plain;
+    std::shared_ptr<const Palette> palette;
+    auto refreshPalette = [&] {
+        bool byType = paletteMode == PaletteMode::Extension || paletteMode == PaletteMode::Kind;
+        palette = buildPalette(paletteMode, byType ? typeHistogram(*root) : TypeHistogram(), owners, font);
+    };
+
+    std::atomic<std::uint64_t> totalNodes{ root->descendants + 1 };
+
+    // Switch to another version of the snapshot store. Zoom and camera stay;
+    // focus and selection go back to the root, as nodes may have gone.
+    auto showVersion = [&](std::size_t version) {
+        if (historyPath.empty() || version >= history.versions() ||
+            (historyTree.root && version == historyTree.version))
+            return;
+        if (!history.load(version, historyTree)) {
+            std::cerr << "Failed to read version " << version + 1 << " of " << historyPath << ".\n";
+            return;
+        }
+        root = historyTree.root;
+        focus = root.get();
+        selectedNode = nullptr;
+        if (isDrawLabels)
+            slotWidth = measureLabels(*root, font) + HORIZONTAL_PADDING;
+        if (topReport || ownerReport)
+            computeLeafs(*root, topReport, ownerReport);
+        relayout();
+        totalNodes = root->descendants + 1;
+        rebuildColumns();
+        applyFilter();
+        refreshPalette();
+    };
+
+    // Built after the window, which provides the GL context it renders with
+    const GlyphAtlas atlas(font, usedNameBytes(*root), allowSdf);
+
+    // This thread owns the tree: it handles events, changes the tree and
+    // publishes snapshots of it. The render thread only ever sees those
+    // snapshots, plus the camera, which is small enough to copy under a lock.
+    SceneExchange exchange;
+    std::mutex viewMutex;
+    FrameState sharedFrame;
+    sf::View sharedView = worldView;
+    // F11 recreates the window, which destroys its GL context, and that
+    // context must not be active on the render thread at the time. The
+    // event thread raises recreatingWindow and waits; the render thread
+    // deactivates the context, acknowledges with contextReleased and waits
+    // in turn until the new window is up, then activates its context.
+    std::mutex handshakeMutex;
+    std::condition_variable handshake;
+    std::atomic<bool> recreatingWindow{ false };
+    bool contextReleased = false;               // guarded by handshakeMutex
+    std::atomic<bool> running{ true };
+    std::atomic<bool> showHud{ false };
+    bool hideUnmatched = false;
+    int topList = -1;
+
+    auto publish = [&] {
+        FrameState frame;
+        frame.focus = focus;
+        frame.selected = selectedNode;
+        frame.camera = camera;
+        frame.zoom = currentZoom;
+        frame.drawLabels = isDrawLabels;
+        frame.top = &top;
+        frame.topList = topList;
+        frame.palette = palette;
+        if (!filterText.empty()) {
+            frame.filter = &filter;
+            frame.hideUnmatched = hideUnmatched;
+        }
+        if (!historyPath.empty()) {
+            frame.versionTimes = &history.times();
+            frame.version = historyTree.version;
+        }
+        const unsigned width = window.getSize().x;
+        if (!exchange.latest() || snapshotStale(*exchange.latest(), frame, width)) {
+            std::shared_ptr<SceneSnapshot> next = exchange.beginUpdate();
+            buildSnapshot(*next, frame, atlas, width);
+            exchange.publish(std::move(next));
+        }
+        std::lock_guard<std::mutex> lock(viewMutex);
+        sharedFrame = frame;
+        sharedView = worldView;
+    };
+    publish();
+
+    // The HUD's small text loads glyphs into its font as it draws, which
+    // would race the event thread's reads of the label font
+    sf::Font hudFont;
+    if (!hudFont.loadFromFile(fontPath)) {
+        std::cerr << "Failed to load font.\n";
+        return 1;
+    }
+
+    window.setActive(false);
+    std::thread renderThread([&] {
+        window.setActive(true);
+        PerfHud hud(hudFont);
+        RenderBuffers buffers;
+        sf::Clock frameClock;
+        while (running) {
+            if (recreatingWindow) {
+                std::unique_lock<std::mutex> lock(handshakeMutex);
+                window.setActive(false);
+                contextReleased = true;
+                handshake.notify_all();
+                handshake.wait(lock, [&] { return !recreatingWindow; });
+                contextReleased = false;
+                window.setActive(true);
+                continue;
+            }
+            TRACE_ZONE("frame");
+            std::uint64_t frameAllocations = threadHeapAllocations;
+
+            FrameState frame;
+            sf::View view;
+            {
+                std::lock_guard<std::mutex> lock(viewMutex);
+                frame = sharedFrame;
+                view = sharedView;
+            }
+            std::shared_ptr<const SceneSnapshot> scene = exchange.current();
+
+            sf::Clock cpuClock;
+            renderFrame(window, view, frame, *scene, atlas, buffers);
+            perfCount(Allocations, threadHeapAllocations - frameAllocations);
+            hud.addFrame(frameClock.restart().asSeconds() * 1000.f,
+                         cpuClock.getElapsedTime().asSeconds() * 1000.f, frameStats);
+            if (showHud)
+                hud.draw(window, totalNodes, treeBytes());
+
+            {
+                TRACE_ZONE("display");
+                window.display();
+            }
+        }
+        window.setActive(false);
+    });
+
+    bool panning = false;
+    bool scrubbing = false;
+    sf::Vector2i dragStart;
+    WorldPos cameraStart;
+
+    sf::Event event;
+    while (running && window.waitEvent(event)) {
+        TRACE_ZONE("event");
+        if (event.type == sf::Event::Closed ||
+           (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::Escape)) {
+            running = false;
+        }
+        else if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::F11) {
+            {
+                std::unique_lock<std::mutex> lock(handshakeMutex);
+                recreatingWindow = true;
+                handshake.wait(lock, [&] { return contextReleased; });
+                isFullscreen = !isFullscreen;
+                if (isFullscreen) {
+                    window.create(sf::VideoMode::getDesktopMode(), windowTitle, sf::Style::Fullscreen);
+                } else {
+                    window.create(windowedMode, windowTitle, sf::Style::Default);
+                }
+                window.setFramerateLimit(60);
+                // create() activated the new context here; hand it over
+                window.setActive(false);
+                recreatingWindow = false;
+            }
+            handshake.notify_all();
+            sf::Vector2f px = window.getDefaultView().getSize();
+            worldView.setSize(px.x * currentZoom, px.y * currentZoom);
+        }
+        else if (event.type == sf::Event::MouseWheelScrolled) {
+            float factor = (event.mouseWheelScroll.delta > 0) ? 0.8f : 1.25f;
+            worldView.zoom(factor);
+            currentZoom *= factor;
+        }
+        else if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Left &&
+                 exchange.latest()->slider.track.contains(float(event.mouseButton.x), float(event.mouseButton.y)) &&
+                 exchange.latest()->slider.versions) {
+            scrubbing = true;
+            showVersion(exchange.latest()->slider.versionAt(float(event.mouseButton.x)));
+        }
+        else if (event.type == sf::Event::MouseMoved && scrubbing) {
+            showVersion(exchange.latest()->slider.versionAt(float(event.mouseMove.x)));
+        }
+        else if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Left &&
+                 std::any_of(exchange.latest()->breadcrumbs.hits.begin(),
+                             exchange.latest()->breadcrumbs.hits.end(), [&](const auto& crumb) {
+                     return crumb.first.contains(float(event.mouseButton.x), float(event.mouseButton.y));
+                 })) {
+            for (auto& crumb : exchange.latest()->breadcrumbs.hits)
+                if (crumb.first.contains(float(event.mouseButton.x), float(event.mouseButton.y))) {
+                    setFocus(crumb.second);
+                    break;
+                }
+        }
+        else if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Left &&
+                 std::any_of(exchange.latest()->topPanel.hits.begin(),
+                             exchange.latest()->topPanel.hits.end(), [&](const auto& line) {
+                     return line.first.contains(float(event.mouseButton.x), float(event.mouseButton.y));
+                 })) {
+            for (auto& line : exchange.latest()->topPanel.hits)
+                if (line.first.contains(float(event.mouseButton.x), float(event.mouseButton.y))) {
+                    jumpTo(line.second);
+                    break;
+                }
+        }
+        else if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Left) {
+            panning = true;
+            dragStart = sf::Mouse::getPosition(window);
+            cameraStart = camera;
+        }
+        else if (event.type == sf::Event::MouseButtonReleased && event.mouseButton.button == sf::Mouse::Left) {
+            panning = false;
+            scrubbing = false;
+        }
+        else if (event.type == sf::Event::MouseMoved && panning) {
+            sf::Vector2i now = sf::Mouse::getPosition(window);
+            WorldPos delta(
+              (dragStart.x - now.x) * double(worldView.getSize().x) / window.getSize().x,
+              (dragStart.y - now.y) * double(worldView.getSize().y) / window.getSize().y
+            );
+            camera = cameraStart + delta;
+        }
+        // Right-click: find nearest node
+        else if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Right) {
+            auto pixel = sf::Mouse::getPosition(window);
+            selectedNode = pickNearest(*focus, pixelToWorld(pixel));
+        }
+        // Middle-click: collapse/expand nearest node
+        else if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Middle) {
+            auto pixel = sf::Mouse::getPosition(window);
+            toggleNode(pickNearest(*focus, pixelToWorld(pixel)));
+        }
+        // Space: collapse/expand the selected node
+        else if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::Space) {
+            toggleNode(selectedNode);
+        }
+        // Enter: focus on the selected subtree, Backspace: go up one level
+        else if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::Enter) {
+            setFocus(selectedNode);
+        }
+        else if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::Backspace) {
+            setFocus(focus->parent);
+        }
+        else if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::F3) {
+            showHud = !showHud;
+        }
+        // C: colour edges by the next palette
+        else if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::C) {
+            paletteMode = PaletteMode((int(paletteMode) + 1) % int(PaletteMode::Count));
+            refreshPalette();
+        }
+        // T: show the next top list, then none
+        else if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::T) {
+            topList = topList + 1 < TopKindCount ? topList + 1 : -1;
+        }
+        // H: hide the branches a --filter does not match, or fade them again
+        else if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::H) {
+            hideUnmatched = !hideUnmatched;
+        }
+        // Left/Right: previous/next version of the snapshot store
+        else if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::Left) {
+            if (historyTree.version > 0)
+                showVersion(historyTree.version - 1);
+        }
+        else if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::Right) {
+            showVersion(historyTree.version + 1);
+        }
+        publish();
+    }
+
+    running = false;
+    renderThread.join();
+    return 0;
+}